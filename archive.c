@@ -50,6 +50,7 @@ int archive_load_script( const char *file )
 	size_t size;
 	int top, new_top;
 
+	TRACE_BEGIN( "load script" );
 	top = lua_gettop( base_engine_state );
 	archive_load_data( file, (void**)&script, &size );
 	if ( script == NULL ) {
@@ -60,6 +61,7 @@ int archive_load_script( const char *file )
 	}
 	SDL_free( script );
 	new_top = lua_gettop( base_engine_state );
+	TRACE_END( );
 	return new_top - top;
 }
 
@@ -89,20 +91,25 @@ void *archive_load_font( const char *filename, int size )
 	char buf[264];
 
 	if ( asset_acquire((void*)filename) != NULL ) return (void*)filename;
+	TRACE_BEGIN( "load font" );
 	font = TTF_OpenFontRW( archive_open_file(filename), 1, size );
 	if ( font == NULL ) {
 		fatal( "Failed to load font %s:\n%s\n", filename, TTF_GetError() );
 	}
 	SDL_snprintf( buf, 256, "%s:%d", filename, size );
-	return asset_create( buf, font, ASSET_FONT );
+	asset = asset_create( buf, font, ASSET_FONT );
+	TRACE_END( );
+	return asset;
 }
 
 void *archive_load_image( const char *filename )
 {
 	SDL_Texture *texture;
 	SDL_Surface *surface;
+	void *asset;
 
 	if ( asset_acquire((void*)filename) != NULL ) return (void*)filename;
+	TRACE_BEGIN( "load image" );
 	surface = IMG_Load_RW( archive_open_file(filename), 1 );
 	if ( surface == NULL ) {
 		fatal( "%s", IMG_GetError() );
@@ -113,48 +120,51 @@ void *archive_load_image( const char *filename )
 	}
 	SDL_FreeSurface( surface );
 	SDL_SetTextureBlendMode( texture, SDL_BLENDMODE_BLEND );
-	return asset_create( filename, texture, ASSET_IMAGE );
+	asset = asset_create( filename, texture, ASSET_IMAGE );
+	TRACE_END( );
+	return asset;
 }
 
 void *archive_load_sound( const char *filename )
 {
 	Mix_Chunk *sound;
+	void *asset;
 
 	if ( asset_acquire((void*)filename) != NULL ) return (void*)filename;
+	TRACE_BEGIN( "load sound" );
 	sound = Mix_LoadWAV_RW( archive_open_file(filename), 1 );
 	if ( sound == NULL ) {
 		fatal( "%s", Mix_GetError() );
 	}
-	return asset_create( filename, sound, ASSET_SOUND );
+	asset = asset_create( filename, sound, ASSET_SOUND );
+	TRACE_END( );
+	return asset;
 }
 
 static int moonbase_archive_font( lua_State *s )
 {
 	void *font;
-	extern luaL_Reg moonbase_font_methods[];
 
 	font = archive_load_font( luaL_checkstring(s, 1), luaL_checkinteger(s, 2) );
-	luacom_create_object( s, "moonbase_font", &font, sizeof(font), moonbase_font_methods );
+	luacom_create_object( s, &moonbase_font_class, &font, sizeof(font) );
 	return 1;
 }
 
 static int moonbase_archive_image( lua_State *s )
 {
 	void *image;
-	extern luaL_Reg moonbase_image_methods[];
 
 	image = archive_load_image( luaL_checkstring(s, 1) );
-	luacom_create_object( s, "moonbase_image", &image, sizeof(image), moonbase_image_methods );
+	luacom_create_object( s, &moonbase_image_class, &image, sizeof(image) );
 	return 1;
 }
 
 static int moonbase_archive_sound( lua_State *s )
 {
 	void *sound;
-	extern luaL_Reg moonbase_sound_methods[];
 
 	sound = archive_load_sound( luaL_checkstring(s, 1) );
-	luacom_create_object( s, "moonbase_sound", &sound, sizeof(sound), moonbase_sound_methods );
+	luacom_create_object( s, &moonbase_sound_class, &sound, sizeof(sound) );
 	return 1;
 }
 
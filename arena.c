@@ -0,0 +1,222 @@
+#include "moonbase.h"
+
+#ifdef _MSC_VER
+#define ARENA_THREAD_LOCAL	__declspec(thread)
+#else
+#define ARENA_THREAD_LOCAL	__thread
+#endif
+
+/*
+ * A Lua allocator for the many small strings, tables and closures a
+ * script churns through. Blocks up to ARENA_MAX_SMALL bytes are rounded
+ * up to a multiple of ARENA_GRANULE and carved from chunks; freed blocks
+ * go on a free list per size class. Lua passes the old size on every
+ * free and resize, so blocks need no header. Larger blocks go straight
+ * to SDL_malloc, with one spare granule so a failed shrink can turn the
+ * block into a chunk of its own (see arena_adopt).
+ */
+#define ARENA_GRANULE		16
+#define ARENA_MAX_SMALL		512
+#define ARENA_CLASSES		( ARENA_MAX_SMALL / ARENA_GRANULE )
+#define ARENA_CHUNK_SIZE	65536
+
+struct arena_block {
+	struct arena_block	*next;
+};
+
+/* Each thread carves from and frees to its own lists, so the allocator
+ * takes no locks; the lock only guards adding arenas to the list. Chunks
+ * are only returned at shutdown, so a block may be freed on a thread
+ * other than the one that carved it. */
+struct arena {
+	struct arena_block	*free[ ARENA_CLASSES ];
+	char			*cursor, *limit;
+	void			**chunks;
+	struct arena		*next;
+};
+
+static struct arena		*arena_list;
+static SDL_SpinLock		arena_lock;
+static struct arena_stats	arena_stats;
+static ARENA_THREAD_LOCAL struct arena	*arena_local;
+
+static struct arena *arena_register( )
+{
+	struct arena *a;
+
+	a = (struct arena*)SDL_calloc( 1, sizeof(struct arena) );
+	if ( a == NULL ) {
+		fatal( "Failed to allocate arena\n" );
+	}
+	SDL_AtomicLock( &arena_lock );
+	a->next = arena_list;
+	arena_list = a;
+	SDL_AtomicUnlock( &arena_lock );
+	arena_local = a;
+	return a;
+}
+
+/* Chunks are linked through their first block */
+static void *arena_carve( struct arena *a, size_t size )
+{
+	void **chunk;
+	void *p;
+
+	if ( (size_t)(a->limit - a->cursor) < size ) {
+		chunk = (void**)SDL_malloc( ARENA_CHUNK_SIZE );
+		if ( chunk == NULL ) {
+			return NULL;
+		}
+		*chunk = a->chunks;
+		a->chunks = chunk;
+		a->cursor = (char*)chunk + ARENA_GRANULE;
+		a->limit = (char*)chunk + ARENA_CHUNK_SIZE;
+		arena_stats.reserved += ARENA_CHUNK_SIZE;
+	}
+	p = a->cursor;
+	a->cursor += size;
+	return p;
+}
+
+static void *arena_get( size_t size )
+{
+	struct arena *a;
+	struct arena_block *b;
+	int c;
+
+	a = arena_local ? arena_local : arena_register( );
+	c = ( size - 1 ) / ARENA_GRANULE;
+	b = a->free[c];
+	if ( b != NULL ) {
+		a->free[c] = b->next;
+		return b;
+	}
+	return arena_carve( a, (c + 1) * ARENA_GRANULE );
+}
+
+static void arena_put( void *p, size_t size )
+{
+	struct arena *a;
+	struct arena_block *b;
+	int c;
+
+	a = arena_local ? arena_local : arena_register( );
+	c = ( size - 1 ) / ARENA_GRANULE;
+	b = (struct arena_block*)p;
+	b->next = a->free[c];
+	a->free[c] = b;
+}
+
+/* Lua expects shrinking to succeed. When a large block shrinks into the
+ * small range and nothing is left to carve from, the block itself
+ * becomes a chunk: the link takes the spare granule in front and the data
+ * moves up behind it, so it is freed with the chunks like any small block */
+static void *arena_adopt( void *ptr, size_t osize, size_t nsize )
+{
+	struct arena *a;
+	void **chunk;
+
+	a = arena_local ? arena_local : arena_register( );
+	memmove( (char*)ptr + ARENA_GRANULE, ptr, nsize );
+	chunk = (void**)ptr;
+	*chunk = a->chunks;
+	a->chunks = chunk;
+	arena_stats.reserved += osize + ARENA_GRANULE;
+	return (char*)ptr + ARENA_GRANULE;
+}
+
+static void arena_count( size_t osize, size_t nsize )
+{
+	arena_stats.live += nsize - osize;
+	if ( arena_stats.live > arena_stats.peak ) {
+		arena_stats.peak = arena_stats.live;
+	}
+	arena_stats.small += ( nsize <= ARENA_MAX_SMALL ? nsize : 0 ) - ( osize <= ARENA_MAX_SMALL ? osize : 0 );
+	arena_stats.large += ( nsize > ARENA_MAX_SMALL ? nsize : 0 ) - ( osize > ARENA_MAX_SMALL ? osize : 0 );
+}
+
+/* The statistics are plain counters; a Lua state, and so this allocator,
+ * is only ever run by one thread at a time. */
+void *arena_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+	void *p;
+
+	if ( ptr == NULL ) {
+		osize = 0;
+	}
+	if ( nsize == 0 ) {
+		if ( ptr != NULL ) {
+			if ( osize <= ARENA_MAX_SMALL ) {
+				arena_put( ptr, osize );
+			} else {
+				SDL_free( ptr );
+			}
+			arena_count( osize, 0 );
+		}
+		return NULL;
+	}
+	if ( osize > ARENA_MAX_SMALL && nsize > ARENA_MAX_SMALL ) {
+		p = SDL_realloc( ptr, nsize + ARENA_GRANULE );
+	} else if ( ptr != NULL && osize <= ARENA_MAX_SMALL && nsize <= ARENA_MAX_SMALL
+		&& (osize - 1) / ARENA_GRANULE == (nsize - 1) / ARENA_GRANULE ) {
+		p = ptr;
+	} else {
+		p = nsize <= ARENA_MAX_SMALL ? arena_get( nsize ) : SDL_malloc( nsize + ARENA_GRANULE );
+		if ( p != NULL && ptr != NULL ) {
+			memcpy( p, ptr, osize < nsize ? osize : nsize );
+			if ( osize <= ARENA_MAX_SMALL ) {
+				arena_put( ptr, osize );
+			} else {
+				SDL_free( ptr );
+			}
+		}
+	}
+	if ( p == NULL && ptr != NULL && nsize < osize ) {
+		if ( osize > ARENA_MAX_SMALL && nsize <= ARENA_MAX_SMALL ) {
+			p = arena_adopt( ptr, osize, nsize );
+		} else {
+			/* The block stays where it is, and is later filed under
+			 * the smaller class or freed as a large block */
+			p = ptr;
+		}
+	}
+	if ( p != NULL ) {
+		arena_count( osize, nsize );
+	}
+	return p;
+}
+
+const struct arena_stats *arena_get_stats( )
+{
+	return &arena_stats;
+}
+
+/* Carved bytes that are not holding a live small block, as a fraction of
+ * the chunk memory reserved: free-listed blocks, rounding and the unused
+ * chunk tails. */
+double arena_get_fragmentation( )
+{
+	if ( arena_stats.reserved == 0 ) {
+		return 0.0;
+	}
+	return 1.0 - (double)arena_stats.small / arena_stats.reserved;
+}
+
+/* Returns every chunk; call only once the Lua state has been closed */
+void arena_shutdown( )
+{
+	struct arena *a, *next;
+	void **chunk, **next_chunk;
+
+	for ( a = arena_list; a != NULL; a = next ) {
+		next = a->next;
+		for ( chunk = (void**)a->chunks; chunk != NULL; chunk = next_chunk ) {
+			next_chunk = (void**)*chunk;
+			SDL_free( chunk );
+		}
+		SDL_free( a );
+	}
+	arena_list = NULL;
+	arena_local = NULL;
+	SDL_zero( arena_stats );
+}
@@ -1,6 +1,6 @@
 #include "moonbase.h"
 
-static struct mht *asset_table;
+static struct cmht *asset_table;
 
 void asset_free_entry( void *k, void *v )
 {
@@ -13,7 +13,7 @@ void asset_free_entry( void *k, void *v )
 		TTF_CloseFont( ent->handle );
 		break;
 	case ASSET_IMAGE:
-		SDL_DestroyTexture( ent->handle );
+		render_destroy_texture( ent->handle );
 		break;
 	case ASSET_SOUND:
 		Mix_FreeChunk( ent->handle );
@@ -24,7 +24,7 @@ void asset_free_entry( void *k, void *v )
 
 void asset_initialize( )
 {
-	asset_table = mht_strk_new( 128, asset_free_entry );
+	asset_table = cmht_strk_new( 16, 128, asset_free_entry );
 	if ( asset_table == NULL ) {
 		fatal( "Failed to create asset table" );
 	}
@@ -32,7 +32,7 @@ void asset_initialize( )
 
 void asset_shutdown( )
 {
-	mht_free( asset_table );
+	cmht_free( asset_table );
 }
 
 void *asset_create( const char *path, void *handle, int asset_type )
@@ -41,6 +41,7 @@ void *asset_create( const char *path, void *handle, int asset_type )
 	char *key;
 	struct asset *ent;
 
+	TRACE_BEGIN( "create asset" );
 	if ( path != NULL ) {
 		key = SDL_strdup( path );
 	} else {
@@ -51,53 +52,69 @@ void *asset_create( const char *path, void *handle, int asset_type )
 	ent->type = asset_type;
 	ent->handle = handle;
 	ent->refcount = 1;
-	mht_set( asset_table, key, ent, 1 );
+	cmht_set( asset_table, key, ent, 1 );
+	TRACE_END( );
 	return key;
 }
 
-struct asset *asset_find( void *key )
+static int asset_copy_entry( void *k, void *v, void *arg )
 {
-	struct asset *ent;
+	*(struct asset*)arg = *(struct asset*)v;
+	return 0;
+}
 
-	if ( mht_get(asset_table, key, (void**)&ent) ) return NULL;
-	return ent;
+/* Copies the entry for key into ent under the shard lock; returns 0 if
+ * there is none. The handle stays valid only while the caller holds a
+ * reference to the asset, as a later release may free it. */
+int asset_find( void *key, struct asset *ent )
+{
+	return cmht_read( asset_table, key, asset_copy_entry, ent ) == 0;
+}
+
+static void *asset_handle( void *key )
+{
+	struct asset ent;
+
+	if ( !asset_find(key, &ent) ) return NULL;
+	return ent.handle;
+}
+
+static int asset_increment_refcount( void *k, void *v, void *arg )
+{
+	++((struct asset*)v)->refcount;
+	return 0;
+}
+
+static int asset_decrement_refcount( void *k, void *v, void *arg )
+{
+	return ( --((struct asset*)v)->refcount <= 0 );
 }
 
 void *asset_acquire( void *key )
 {
-	struct asset *ent;
-	
-	ent = asset_find( key );
-	if ( ent == NULL ) return NULL;
-	++asset_find( key )->refcount;
+	if ( cmht_update(asset_table, key, asset_increment_refcount, NULL) ) return NULL;
 	return key;
 }
 
 void *asset_release( void *key )
 {
-	struct asset *ent;
-
-	ent = asset_find( key );
-	if ( --ent->refcount <= 0 ) {
-		mht_delete( asset_table, key );
-		return NULL;
-	}
+	if ( cmht_update(asset_table, key, asset_decrement_refcount, NULL) ) return NULL;
 	return key;
 }
 
 SDL_Texture *asset_image_handle( void *key )
 {
-	return (SDL_Texture*)asset_find(key)->handle;
+	return (SDL_Texture*)asset_handle( key );
 }
 
 TTF_Font *asset_font_handle( void *key )
 {
-	return (TTF_Font*)asset_find(key)->handle;
+	return (TTF_Font*)asset_handle( key );
 }
 
 Mix_Chunk *asset_sound_handle( void *key )
 {
-	return (Mix_Chunk*)asset_find(key)->handle;
+	return (Mix_Chunk*)asset_handle( key );
 }
 
 
@@ -245,7 +245,7 @@ static int moonbase_channel_pause( lua_State *s )
 {
 	int channel;
 
-	channel = *(int*)luaL_checkudata( s, 1, "moonbase_channel" );
+	channel = *(int*)luacom_check_object( s, 1, &moonbase_channel_class );
 	channel_pause( channel );
 	return 0;
 }
@@ -254,7 +254,7 @@ static int moonbase_channel_resume( lua_State *s )
 {
 	int channel;
 
-	channel = *(int*)luaL_checkudata( s, 1, "moonbase_channel" );
+	channel = *(int*)luacom_check_object( s, 1, &moonbase_channel_class );
 	channel_resume( channel );
 	return 0;
 }
@@ -263,7 +263,7 @@ static int moonbase_channel_stop( lua_State *s )
 {
 	int channel, fade_ms;
 
-	channel = *(int*)luaL_checkudata( s, 1, "moonbase_channel" );
+	channel = *(int*)luacom_check_object( s, 1, &moonbase_channel_class );
 	fade_ms = luaL_optint( s, 2, 0 );
 	channel_stop( channel, fade_ms );
 	return 0;
@@ -273,7 +273,7 @@ static int moonbase_channel_get_volume( lua_State *s )
 {
 	int channel;
 	
-	channel = *(int*)luaL_checkudata( s, 1, "moonbase_channel" );
+	channel = *(int*)luacom_check_object( s, 1, &moonbase_channel_class );
 	lua_pushnumber( s, channel_get_volume(channel) );
 	return 1;
 }
@@ -283,7 +283,7 @@ static int moonbase_channel_set_volume( lua_State *s )
 	int channel;
 	float volume;
 
-	channel = *(int*)luaL_checkudata( s, 1, "moonbase_channel" );
+	channel = *(int*)luacom_check_object( s, 1, &moonbase_channel_class );
 	volume = luaL_checknumber( s, 2 );
 	channel_set_volume( channel, volume );
 	return 0;
@@ -298,15 +298,17 @@ static luaL_Reg moonbase_channel_methods[] = {
 	{ NULL, NULL }
 };
 
+struct luacom_class moonbase_channel_class = { "moonbase_channel", moonbase_channel_methods };
+
 static int moonbase_sound_play( lua_State *s )
 {
 	void *sound;
 	int fade_ms, channel;
 
-	sound = *(void**)luaL_checkudata( s, 1, "moonbase_sound" );
+	sound = *(void**)luacom_check_object( s, 1, &moonbase_sound_class );
 	fade_ms = luaL_optint( s, 2, 0 );
 	channel = sound_play( sound, fade_ms, 0 );
-	luacom_create_object( s, "moonbase_channel", &channel, sizeof(channel), moonbase_channel_methods );
+	luacom_create_object( s, &moonbase_channel_class, &channel, sizeof(channel) );
 	return 1;
 }
 
@@ -315,10 +317,10 @@ static int moonbase_sound_loop( lua_State *s )
 	void *sound;
 	int channel, fade_ms;
 
-	sound = *(void**)luaL_checkudata( s, 1, "moonbase_sound" );
+	sound = *(void**)luacom_check_object( s, 1, &moonbase_sound_class );
 	fade_ms = luaL_optint( s, 2, 0 );
 	channel = sound_play( sound, fade_ms, 1 );
-	luacom_create_object( s, "moonbase_channel", &channel, sizeof(channel), moonbase_channel_methods );
+	luacom_create_object( s, &moonbase_channel_class, &channel, sizeof(channel) );
 	return 1;
 }
 
@@ -326,7 +328,7 @@ static int moonbase_sound_gc( lua_State *s )
 {
 	void *sound;
 
-	sound = *(void**)luaL_checkudata( s, 1, "moonbase_sound" );
+	sound = *(void**)luacom_check_object( s, 1, &moonbase_sound_class );
 	asset_release( sound );
 	return 0;
 }
@@ -337,3 +339,5 @@ luaL_Reg moonbase_sound_methods[] = {
 	{ "__gc", moonbase_sound_gc },
 	{ NULL, NULL }
 };
+
+struct luacom_class moonbase_sound_class = { "moonbase_sound", moonbase_sound_methods };
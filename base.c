@@ -1,6 +1,9 @@
 #include "moonbase.h"
 
 int		base_pool_size;
+int		base_arena;
+double		base_gc_pause;
+int		base_memory_budget;
 char		*base_game_path;
 char		*base_data_path;
 char		*base_config_script;
@@ -8,8 +11,16 @@ char		*base_main_script;
 TALLOC_CTX	*base_pool;
 lua_State	*base_engine_state;
 lua_State	*base_game_state;
+lua_State	*base_running_state;
 int		base_fps;
 Uint32		base_resume_time;
+int		base_headless;
+int		base_frame_limit;
+char		*base_record_path;
+char		*base_replay_path;
+char		*base_trace_path;
+char		*base_profile_path;
+char		*base_alloc_profile_path;
 
 static void *base_engine_state_allocator( void *ud, void *ptr, size_t osize, size_t nsize )
 {
@@ -38,7 +49,17 @@ static void base_help( const char *argv0 )
 		"-m     Specify script to load after window creation (Default: main.lua)\n"
 		"-d     Path for game to save data (Default value platform dependent)\n"
 		"-p     Have lua use a memory pool; specify size of pool in megabytes\n"
-		"-l     Set log level from 1-6, higher is more verbose. (Default: 4)\n",
+		"-a     Have lua use the size-class arena allocator\n"
+		"-b     Keep lua within a memory budget; specify the budget in megabytes\n"
+		"-g     Drive the garbage collector from the frame loop, pausing at most the given milliseconds per frame\n"
+		"-l     Set log level from 1-6, higher is more verbose. (Default: 4)\n"
+		"-x     Run headless with dummy video and audio drivers, unpaced\n"
+		"-n     Quit after the given number of frames and print timing stats\n"
+		"-r     Record input to the given file in the data path\n"
+		"-R     Replay input recorded with -r, then quit\n"
+		"-t     Write a Chrome trace of engine and script zones to the given file in the data path\n"
+		"-s     Sample Lua stacks and write folded stacks to the given file in the data path\n"
+		"-A     Attribute Lua allocations to source lines; write a report to the given file in the data path\n",
 		argv0 );
 }
 
@@ -48,6 +69,9 @@ void base_initialize( int argc, char *argv[] )
 	char *p;
 
 	base_pool_size = 0;
+	base_arena = 0;
+	base_gc_pause = 0;
+	base_memory_budget = 0;
 	base_pool = NULL;
 	base_game_path = NULL;
 	base_data_path = NULL;
@@ -55,6 +79,13 @@ void base_initialize( int argc, char *argv[] )
 	base_main_script = NULL;
 	base_fps = 30;
 	base_resume_time = 0;
+	base_headless = 0;
+	base_frame_limit = 0;
+	base_record_path = NULL;
+	base_replay_path = NULL;
+	base_trace_path = NULL;
+	base_profile_path = NULL;
+	base_alloc_profile_path = NULL;
 
 	SDL_Init( 0 );
 	log_set_verbosity( LOG_VERBOSE );
@@ -81,6 +112,15 @@ void base_initialize( int argc, char *argv[] )
 		case 'p':
 			base_pool_size = SDL_atoi( argv[++i] );
 			break;
+		case 'a':
+			base_arena = 1;
+			break;
+		case 'b':
+			base_memory_budget = SDL_atoi( argv[++i] );
+			break;
+		case 'g':
+			base_gc_pause = SDL_atof( argv[++i] );
+			break;
 		case 'd':
 			base_data_path = SDL_strdup( argv[++i] );
 			break;
@@ -91,6 +131,27 @@ void base_initialize( int argc, char *argv[] )
 				log_increment_verbosity( );
 			}
 			break;
+		case 'x':
+			base_headless = 1;
+			break;
+		case 'n':
+			base_frame_limit = SDL_atoi( argv[++i] );
+			break;
+		case 'r':
+			base_record_path = SDL_strdup( argv[++i] );
+			break;
+		case 'R':
+			base_replay_path = SDL_strdup( argv[++i] );
+			break;
+		case 't':
+			base_trace_path = SDL_strdup( argv[++i] );
+			break;
+		case 's':
+			base_profile_path = SDL_strdup( argv[++i] );
+			break;
+		case 'A':
+			base_alloc_profile_path = SDL_strdup( argv[++i] );
+			break;
 		case 'h':
 			base_help( argv[0] );
 			exit( 0 );
@@ -113,13 +174,22 @@ void base_initialize( int argc, char *argv[] )
 	if ( base_data_path == NULL ) {
 		base_data_path = SDL_GetPrefPath( "swoope", "moonbase" );
 	}
+	if ( base_headless ) {
+		SDL_setenv( "SDL_VIDEODRIVER", "dummy", 1 );
+		SDL_setenv( "SDL_AUDIODRIVER", "dummy", 1 );
+	}
 
 	TTF_Init( );
 	IMG_Init( IMG_INIT_JPG|IMG_INIT_PNG );
 	asset_initialize( );
 	archive_initialize( );
 
-	if ( base_pool_size != 0 ) {
+	if ( base_arena && base_pool_size != 0 ) {
+		fatal( "-a and -p cannot be used together\n" );
+	}
+	if ( base_arena ) {
+		base_engine_state = lua_newstate( arena_alloc, NULL );
+	} else if ( base_pool_size != 0 ) {
 		base_pool = talloc_pool( NULL, base_pool_size * (1024*1024) );
 		if ( base_pool == NULL ) {
 			fatal( "Failed to allocate lua memory pool\n" );
@@ -132,6 +202,10 @@ void base_initialize( int argc, char *argv[] )
 	if ( base_engine_state == NULL ) {
 		fatal( "Failed to initialize Lua\n" );
 	}
+	base_running_state = base_engine_state;
+	if ( base_memory_budget > 0 ) {
+		memory_initialize( (size_t)base_memory_budget * (1024*1024) );
+	}
 
 	luaL_openlibs( base_engine_state );
 	luacom_get_global_field( base_engine_state, "package", "searchers", NULL );
@@ -147,6 +221,9 @@ void base_shutdown( )
 	if ( base_pool != NULL ) {
 		talloc_free( base_pool );
 	}
+	if ( base_arena ) {
+		arena_shutdown( );
+	}
 	archive_shutdown( );
 	asset_shutdown( );
 	IMG_Quit( );
@@ -155,6 +232,11 @@ void base_shutdown( )
 	SDL_free( base_data_path );
 	SDL_free( base_config_script );
 	SDL_free( base_main_script );
+	SDL_free( base_record_path );
+	SDL_free( base_replay_path );
+	SDL_free( base_trace_path );
+	SDL_free( base_profile_path );
+	SDL_free( base_alloc_profile_path );
 }
 
 static int moonbase_quit( lua_State *s )
@@ -171,14 +253,63 @@ static int moonbase_get_fps( lua_State *s )
 
 static int moonbase_set_fps( lua_State *s )
 {
-	base_fps = luaL_checkinteger( s, 1 );
+	int fps;
+
+	fps = luaL_checkinteger( s, 1 );
+	luaL_argcheck( s, fps > 0, 1, "fps must be positive" );
+	base_fps = fps;
+	pacer_reset_stats( );
+	return 0;
+}
+
+static int moonbase_get_timestep( lua_State *s )
+{
+	lua_pushnumber( s, game_get_timestep() );
+	return 1;
+}
+
+static int moonbase_set_timestep( lua_State *s )
+{
+	double rate;
+
+	rate = luaL_checknumber( s, 1 );
+	luaL_argcheck( s, rate >= 0, 1, "rate must not be negative" );
+	game_set_timestep( rate, luaL_optint(s, 2, 5) );
+	return 0;
+}
+
+static int moonbase_get_gc_pause( lua_State *s )
+{
+	lua_pushnumber( s, gc_get_max_pause() );
+	return 1;
+}
+
+static int moonbase_set_gc_pause( lua_State *s )
+{
+	double pause;
+
+	pause = luaL_checknumber( s, 1 );
+	luaL_argcheck( s, pause >= 0, 1, "pause must not be negative" );
+	gc_set_max_pause( pause );
+	return 0;
+}
+
+static int moonbase_is_idle( lua_State *s )
+{
+	lua_pushboolean( s, game_is_idle() );
+	return 1;
+}
+
+static int moonbase_set_idle( lua_State *s )
+{
+	game_set_idle( lua_toboolean(s, 1) );
 	return 0;
 }
 
 static int moonbase_yield( lua_State *s )
 {
 	if ( lua_gettop(s) == 1 ) {
-		base_resume_time = SDL_GetTicks( ) + luaL_checkunsigned( s, 1 );
+		base_resume_time = game_get_ticks( ) + luaL_checkunsigned( s, 1 );
 	} else {
 		base_resume_time = 0;
 	}
@@ -193,22 +324,143 @@ static int moonbase_resume( lua_State *s )
 	base_resume_time = 0;
 	nargs = lua_gettop( base_engine_state );
 	lua_xmove( base_engine_state, base_game_state, nargs );
-	lua_resume( base_game_state, base_engine_state, nargs );
+	base_resume( nargs );
 	return lua_gettop( base_game_state );
 }
 
 static int moonbase_get_ticks( lua_State *s )
 {
-	lua_pushunsigned( s, SDL_GetTicks() );
+	lua_pushunsigned( s, game_get_ticks() );
 	return 1;
 }
 
+static int moonbase_stats( lua_State *s )
+{
+	const struct render_stats *render;
+	const struct pacer_stats *pacer;
+	const struct game_stats *game;
+	const struct arena_stats *arena;
+	const struct gc_stats *gc;
+	const struct memory_stats *memory;
+	struct timing_percentiles phase;
+	struct layer *layer;
+	int i;
+
+	render = render_get_stats( );
+	pacer = pacer_get_stats( );
+	game = game_get_stats( );
+	gc = gc_get_stats( );
+	lua_createtable( s, 0, 7 );
+	lua_createtable( s, 0, 5 );
+	luacom_write_table( s, -1, "iiiii",
+		"commands", render->commands,
+		"drawCalls", render->draw_calls,
+		"sprites", render->sprites,
+		"stateChanges", render->state_changes,
+		"unsortedStateChanges", render->unsorted_state_changes );
+	lua_newtable( s );
+	for ( i = 1, layer = layer_next(NULL); layer != NULL; ++i, layer = layer_next(layer) ) {
+		lua_createtable( s, 0, 3 );
+		luacom_write_table( s, -1, "sii",
+			"name", layer->name,
+			"hits", layer->hits,
+			"misses", layer->misses );
+		lua_rawseti( s, -2, i );
+	}
+	lua_setfield( s, -2, "layers" );
+	lua_setfield( s, -2, "render" );
+	lua_createtable( s, 0, 7 );
+	luacom_write_table( s, -1, "iinnnn",
+		"frames", pacer->frames,
+		"late", pacer->late,
+		"mean", pacer->mean,
+		"jitter", pacer->jitter,
+		"max", pacer->max,
+		"bucketWidth", PACER_BUCKET_WIDTH );
+	lua_createtable( s, PACER_BUCKETS, 0 );
+	for ( i = 0; i < PACER_BUCKETS; ++i ) {
+		lua_pushinteger( s, pacer->histogram[i] );
+		lua_rawseti( s, -2, i + 1 );
+	}
+	lua_setfield( s, -2, "histogram" );
+	lua_setfield( s, -2, "frame" );
+	lua_createtable( s, 0, 4 );
+	luacom_write_table( s, -1, "iiin",
+		"steps", game->steps,
+		"dropped", game->dropped,
+		"wakeups", game->wakeups,
+		"idleTime", game->idle_time );
+	lua_setfield( s, -2, "update" );
+	lua_createtable( s, 0, 5 );
+	luacom_write_table( s, -1, "iiinn",
+		"steps", gc->steps,
+		"cycles", gc->cycles,
+		"backstops", gc->backstops,
+		"time", gc->time,
+		"maxPause", gc_get_max_pause() );
+	lua_setfield( s, -2, "gc" );
+	if ( base_memory_budget > 0 ) {
+		memory = memory_get_stats( );
+		lua_createtable( s, 0, 7 );
+		luacom_write_table( s, -1, "nnniiii",
+			"used", (double)memory->used,
+			"peak", (double)memory->peak,
+			"limit", (double)memory->limit,
+			"collections", memory->collections,
+			"drops", memory->drops,
+			"warnings", memory->warnings,
+			"refusals", memory->refusals );
+		lua_setfield( s, -2, "memory" );
+	}
+	lua_createtable( s, 0, TIMING_PHASES );
+	for ( i = 0; i < TIMING_PHASES; ++i ) {
+		timing_get_percentiles( i, &phase );
+		lua_createtable( s, 0, 4 );
+		luacom_write_table( s, -1, "nnnn",
+			"p50", (double)phase.p50,
+			"p95", (double)phase.p95,
+			"p99", (double)phase.p99,
+			"max", (double)phase.max );
+		lua_setfield( s, -2, timing_get_name(i) );
+	}
+	lua_setfield( s, -2, "phases" );
+	if ( base_arena ) {
+		arena = arena_get_stats( );
+		lua_createtable( s, 0, 6 );
+		luacom_write_table( s, -1, "iiiiin",
+			"live", (int)arena->live,
+			"peak", (int)arena->peak,
+			"small", (int)arena->small,
+			"large", (int)arena->large,
+			"reserved", (int)arena->reserved,
+			"fragmentation", arena_get_fragmentation() );
+		lua_setfield( s, -2, "arena" );
+	}
+	return 1;
+}
+
+static int moonbase_reset_stats( lua_State *s )
+{
+	pacer_reset_stats( );
+	gc_reset_stats( );
+	memory_reset_stats( );
+	return 0;
+}
+
 static luaL_Reg moonbase_methods[] = {
 	{ "getFps", moonbase_get_fps },
 	{ "setFps", moonbase_set_fps },
+	{ "getTimestep", moonbase_get_timestep },
+	{ "setTimestep", moonbase_set_timestep },
+	{ "getGcPause", moonbase_get_gc_pause },
+	{ "setGcPause", moonbase_set_gc_pause },
+	{ "isIdle", moonbase_is_idle },
+	{ "setIdle", moonbase_set_idle },
 	{ "yield", moonbase_yield },
 	{ "resume", moonbase_resume },
 	{ "getTicks", moonbase_get_ticks },
+	{ "stats", moonbase_stats },
+	{ "resetStats", moonbase_reset_stats },
 	{ "quit", moonbase_quit },
 	{ NULL, NULL }
 };
@@ -226,6 +478,9 @@ void moonbase_initialize( lua_State *s )
 	moonbase_archive_initialize( lua_State * ),
 	moonbase_storage_initialize( lua_State * ),
 	moonbase_text_initialize( lua_State * ),
+	moonbase_trace_initialize( lua_State * ),
+	moonbase_profiler_initialize( lua_State * ),
+	moonbase_geometry_initialize( lua_State * ),
 	moonbase_log_initialize( lua_State * );
 
 	lua_newtable( s );
@@ -242,6 +497,12 @@ void moonbase_initialize( lua_State *s )
 	lua_setfield( s, 1, "archive" );
 	moonbase_storage_initialize( s );
 	lua_setfield( s, 1, "storage" );
+	moonbase_trace_initialize( s );
+	lua_setfield( s, 1, "trace" );
+	moonbase_profiler_initialize( s );
+	lua_setfield( s, 1, "profiler" );
+	moonbase_geometry_initialize( s );
+	lua_setfield( s, 1, "geometry" );
 	lua_newtable( s );
 	lua_pushcfunction( s, moonbase_dummy_function );
 	lua_pushvalue( s, -1 );
@@ -251,12 +512,26 @@ void moonbase_initialize( lua_State *s )
 	lua_setfield( s, 2, "input" );
 	lua_setfield( s, 2, "update" );
 	lua_setfield( s, 2, "shutdown" );
-	lua_setfield( s, 1, "event" );
 	lua_pushcfunction( s, moonbase_dummy_function );
 	lua_setfield( s, 1, "main" );
+	game_install_events( s, 1 );
 	lua_setglobal( s, "moonbase" );
 }
 
+/* Resumes the game thread, keeping track of which state is running for
+ * code that cannot be handed one, such as the allocation profiler. */
+int base_resume( int nargs )
+{
+	lua_State *previous;
+	int status;
+
+	previous = base_running_state;
+	base_running_state = base_game_state;
+	status = lua_resume( base_game_state, base_engine_state, nargs );
+	base_running_state = previous;
+	return status;
+}
+
 char	*vstr(const char *fmt, ...)
 {
 	va_list v;
@@ -38,13 +38,12 @@ static int moonbase_font_render( lua_State *s )
 {
 	void *font, *image;
 	const char *text, *color;
-	extern luaL_Reg moonbase_image_methods[];
 
-	font = *(void**)luaL_checkudata( s, 1, "moonbase_font" );
+	font = *(void**)luacom_check_object( s, 1, &moonbase_font_class );
 	text = luaL_checkstring( s, 2 );
 	color = luaL_checkstring( s, 3 );
 	image = font_render_text( font, text, color );
-	luacom_create_object( s, "moonbase_image", &image, sizeof(image), moonbase_image_methods );
+	luacom_create_object( s, &moonbase_image_class, &image, sizeof(image) );
 	return 1;
 }
 
@@ -54,19 +53,32 @@ static int moonbase_font_get_render_size( lua_State *s )
 	const char *text;
 	struct size size;
 
-	font = *(void**)luaL_checkudata( s, 1, "moonbase_font" );
+	font = *(void**)luacom_check_object( s, 1, &moonbase_font_class );
 	text = luaL_checkstring( s, 2 );
 	font_get_render_size( font, text, &size );
-	lua_newtable( s );
-	luacom_write_array( s, -1, "ii", 1, size.w, 2, size.h );
+	luacom_fill_size( s, 3, size.w, size.h );
 	return 1;
 }
 
+static int moonbase_font_get_render_dimensions( lua_State *s )
+{
+	void *font;
+	const char *text;
+	struct size size;
+
+	font = *(void**)luacom_check_object( s, 1, &moonbase_font_class );
+	text = luaL_checkstring( s, 2 );
+	font_get_render_size( font, text, &size );
+	lua_pushinteger( s, size.w );
+	lua_pushinteger( s, size.h );
+	return 2;
+}
+
 static int moonbase_font_gc( lua_State *s )
 {
 	void *font;
 
-	font = *(void**)luaL_checkudata( s, 1, "moonbase_font" );
+	font = *(void**)luacom_check_object( s, 1, &moonbase_font_class );
 	asset_release( font );
 	return 0;
 }
@@ -74,10 +86,13 @@ static int moonbase_font_gc( lua_State *s )
 luaL_Reg moonbase_font_methods[] = {
 	{ "render", moonbase_font_render },
 	{ "getRenderSize", moonbase_font_get_render_size },
+	{ "getRenderDimensions", moonbase_font_get_render_dimensions },
 	{ "__gc", moonbase_font_gc },
 	{ NULL, NULL }
 };
 
+struct luacom_class moonbase_font_class = { "moonbase_font", moonbase_font_methods };
+
 int moonbase_font_initialize( lua_State *s )
 {
 	luaL_newlib( s, moonbase_font_methods );
@@ -105,12 +120,10 @@ static int moonbase_text_stop( lua_State *s )
 static int moonbase_text_set_rect( lua_State *s )
 {
 	struct rectangle r;
+	int sized;
 
-	luacom_read_array( s, 1, "iiii",
-		1, &r.x, 
-		2, &r.y,
-		3, &r.w,
-		4, &r.h );
+	geometry_check_rect( s, 1, &r, &sized );
+	luaL_argcheck( s, sized, 1, "rectangle expected" );
 	SDL_SetTextInputRect( (SDL_Rect*)&r );
 	return 0;
 }
@@ -1,9 +1,213 @@
 #include "moonbase.h"
 
+/* Fixed timestep state, in performance counter ticks; a zero step runs
+ * one variable length update per frame. */
+static Uint64			game_step;
+static Uint64			game_accumulator;
+static Uint64			game_last;
+static int			game_max_steps;
+static double			game_step_ms;
+static double			game_time;
+static struct game_stats	game_stats;
+
+/* In idle mode the main loop blocks until an event or a yield timer
+ * instead of running frames at the frame rate. */
+static int			game_idle;
+
+/* Frames since startup; while recording or replaying input the clock
+ * is derived from it so both runs see identical times. */
+static Uint32			game_frame;
+
+/*
+ * The moonbase.event callbacks are held as registry references, so an
+ * event costs one lua_rawgeti rather than a walk from the globals.
+ * moonbase.event is kept empty; its metatable reads from the table that
+ * holds the callbacks and routes every write through game_event_newindex,
+ * which refreshes the cached reference. Assigning a table to
+ * moonbase.event adopts it the same way.
+ */
+enum {
+	GAME_EVENT_INITIALIZE,
+	GAME_EVENT_INPUT,
+	GAME_EVENT_UPDATE,
+	GAME_EVENT_RENDER,
+	GAME_EVENT_LOW_MEMORY,
+	GAME_EVENT_SHUTDOWN,
+	GAME_EVENTS
+};
+
+static const char *game_event_names[ GAME_EVENTS ] = {
+	"initialize",
+	"input",
+	"update",
+	"render",
+	"lowMemory",
+	"shutdown"
+};
+
+static int			game_events[ GAME_EVENTS ];
+static int			game_event_table = LUA_NOREF;
+
+/* Pushes the callback for event; returns 0 if there is none */
+static int game_push_event( int event )
+{
+	if ( game_events[event] == LUA_REFNIL || game_events[event] == LUA_NOREF ) {
+		return 0;
+	}
+	lua_rawgeti( base_engine_state, LUA_REGISTRYINDEX, game_events[event] );
+	return 1;
+}
+
+/* Refreshes the cached callback if key names an event */
+static void game_cache_event( lua_State *s, int key, int value )
+{
+	const char *name;
+	int i;
+
+	if ( lua_type(s, key) != LUA_TSTRING ) {
+		return;
+	}
+	name = lua_tostring( s, key );
+	for ( i = 0; i < GAME_EVENTS; ++i ) {
+		if ( strcmp(name, game_event_names[i]) == 0 ) {
+			luaL_unref( s, LUA_REGISTRYINDEX, game_events[i] );
+			lua_pushvalue( s, value );
+			game_events[i] = luaL_ref( s, LUA_REGISTRYINDEX );
+			return;
+		}
+	}
+}
+
+static int game_event_newindex( lua_State *s )
+{
+	lua_getmetatable( s, 1 );
+	lua_getfield( s, -1, "__index" );
+	lua_pushvalue( s, 2 );
+	lua_pushvalue( s, 3 );
+	lua_rawset( s, -3 );
+	/* A table that has since been replaced no longer feeds the cache */
+	lua_rawgeti( s, LUA_REGISTRYINDEX, game_event_table );
+	if ( lua_rawequal(s, 1, -1) ) {
+		game_cache_event( s, 2, 3 );
+	}
+	return 0;
+}
+
+static int game_event_pairs( lua_State *s )
+{
+	lua_getglobal( s, "next" );
+	lua_getmetatable( s, 1 );
+	lua_getfield( s, -1, "__index" );
+	lua_remove( s, -2 );
+	lua_pushnil( s );
+	return 3;
+}
+
+/* Makes the table at index moonbase.event. Its fields move to a new
+ * table behind the metatable, replacing any metatable it had. */
+static void game_adopt_events( lua_State *s, int index )
+{
+	int adopted, store, i;
+
+	adopted = 0;
+	if ( lua_getmetatable(s, index) ) {
+		lua_getfield( s, -1, "__newindex" );
+		adopted = lua_tocfunction( s, -1 ) == game_event_newindex;
+		lua_pop( s, 1 );
+		if ( adopted ) {
+			/* e.g. moonbase.event = moonbase.event */
+			lua_getfield( s, -1, "__index" );
+			lua_remove( s, -2 );
+		} else {
+			lua_pop( s, 1 );
+		}
+	}
+	if ( !adopted ) {
+		lua_newtable( s );
+		store = lua_gettop( s );
+		lua_pushnil( s );
+		while ( lua_next(s, index) ) {
+			lua_pushvalue( s, -2 );
+			lua_insert( s, -2 );
+			lua_rawset( s, store );
+			/* Clearing fields already visited is allowed by lua_next */
+			lua_pushvalue( s, -1 );
+			lua_pushnil( s );
+			lua_rawset( s, index );
+		}
+		lua_createtable( s, 0, 3 );
+		lua_pushvalue( s, store );
+		lua_setfield( s, -2, "__index" );
+		lua_pushcfunction( s, game_event_newindex );
+		lua_setfield( s, -2, "__newindex" );
+		lua_pushcfunction( s, game_event_pairs );
+		lua_setfield( s, -2, "__pairs" );
+		lua_setmetatable( s, index );
+	}
+	store = lua_gettop( s );
+	luaL_unref( s, LUA_REGISTRYINDEX, game_event_table );
+	lua_pushvalue( s, index );
+	game_event_table = luaL_ref( s, LUA_REGISTRYINDEX );
+	for ( i = 0; i < GAME_EVENTS; ++i ) {
+		luaL_unref( s, LUA_REGISTRYINDEX, game_events[i] );
+		lua_getfield( s, store, game_event_names[i] );
+		game_events[i] = luaL_ref( s, LUA_REGISTRYINDEX );
+	}
+	lua_pop( s, 1 );
+}
+
+static int game_moonbase_index( lua_State *s )
+{
+	if ( lua_type(s, 2) == LUA_TSTRING && strcmp(lua_tostring(s, 2), "event") == 0 ) {
+		lua_rawgeti( s, LUA_REGISTRYINDEX, game_event_table );
+		return 1;
+	}
+	return 0;
+}
+
+static int game_moonbase_newindex( lua_State *s )
+{
+	if ( lua_type(s, 2) == LUA_TSTRING && strcmp(lua_tostring(s, 2), "event") == 0 ) {
+		luaL_checktype( s, 3, LUA_TTABLE );
+		game_adopt_events( s, 3 );
+		return 0;
+	}
+	lua_rawset( s, 1 );
+	return 0;
+}
+
+/* Pops the event table and installs it as moonbase.event on the table
+ * at index. event is never stored in moonbase itself, so replacing it
+ * also goes through a metamethod. */
+void game_install_events( lua_State *s, int index )
+{
+	int i;
+
+	index = lua_absindex( s, index );
+	for ( i = 0; i < GAME_EVENTS; ++i ) {
+		game_events[i] = LUA_NOREF;
+	}
+	game_adopt_events( s, lua_gettop(s) );
+	lua_pop( s, 1 );
+	lua_createtable( s, 0, 2 );
+	lua_pushcfunction( s, game_moonbase_index );
+	lua_setfield( s, -2, "__index" );
+	lua_pushcfunction( s, game_moonbase_newindex );
+	lua_setfield( s, -2, "__newindex" );
+	lua_setmetatable( s, index );
+}
+
+
 void game_initialize( )
 {
 	extern int moonbase_initialize( lua_State * );
 
+	game_frame = 0;
+	if ( base_record_path != NULL ) {
+		replay_start_recording( base_record_path );
+	} else if ( base_replay_path != NULL ) {
+		replay_start_playback( base_replay_path );
+	}
 	moonbase_initialize( base_engine_state );
 	if ( archive_contains(base_config_script) ) {
 		archive_load_script( base_config_script );
@@ -11,14 +215,79 @@ void game_initialize( )
 	audio_start_mixer( );
 	video_start_window( );
 	archive_load_script( base_main_script );
-	if ( luacom_get_global_field(base_engine_state, "moonbase", "event", "initialize", NULL) ) {
+	if ( game_push_event(GAME_EVENT_INITIALIZE) ) {
 		lua_call( base_engine_state, 0, 0 );
 	}
 	lua_getglobal( base_engine_state, "moonbase" );
 	base_game_state = lua_newthread( base_engine_state );
 	lua_setfield( base_engine_state, -2, "gameThread_" );
 	luacom_get_global_field( base_game_state, "moonbase", "main", NULL );
-	lua_resume( base_game_state, base_engine_state, 0 );
+	base_resume( 0 );
+}
+
+/* Passes an event to moonbase.event.input; without a handler the event
+ * is dropped. */
+static void game_dispatch( const SDL_Event *e )
+{
+	if ( !game_push_event(GAME_EVENT_INPUT) ) {
+		lua_settop( base_engine_state, 0 );
+		return;
+	}
+
+	lua_createtable( base_engine_state, 0, 5 );
+	switch( e->type ) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		luacom_write_table( base_engine_state, 2, "ssb",
+			"type", "keyboard",
+			"key", SDL_GetKeyName(e->key.keysym.sym),
+			"pressed", (e->type == SDL_KEYDOWN)
+		);
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		luacom_write_table( base_engine_state, 2, "siiib",
+			"type", "mouse",
+			"button", (e->button.button == SDL_BUTTON_LEFT) ? 1 : (
+				(e->button.button == SDL_BUTTON_MIDDLE) ? 2 : 3 ),
+			"x", e->button.x,
+			"y", e->button.y,
+			"pressed", e->type == SDL_MOUSEBUTTONDOWN
+		);
+		break;
+	case SDL_TEXTEDITING:
+		luacom_write_table( base_engine_state, 2, "ssii",
+			"type", "text edit",
+			"text", e->edit.text,
+			"start", e->edit.start,
+			"length", e->edit.length
+		);
+		break;
+	case SDL_TEXTINPUT:
+		luacom_write_table( base_engine_state, 2, "ss",
+			"type", "text input",
+			"text", e->text.text
+		);
+		break;
+	case SDL_MOUSEWHEEL:
+		luacom_write_table( base_engine_state, 2, "ti",
+			"type", "wheel",
+			"direction", (e->wheel.y ? 1 : 2)
+		);
+		break;
+	/*case SDL_MOUSEMOTION:
+		luacom_write_table( base_engine_state, 2, "sii",
+			"type", "motion",
+			"xrel", e->motion.xrel,
+			"yrel", e->motion.yrel
+		);
+		break;
+	*/
+	default:
+		break;
+	}
+	lua_call( base_engine_state, 1, 0 );
+	lua_settop( base_engine_state, 0 );
 }
 
 void game_input( )
@@ -29,83 +298,183 @@ void game_input( )
 		if ( e.type == SDL_QUIT ) {
 			quit( 0 );
 		}
-		if ( !luacom_get_global_field(base_engine_state, "moonbase", "event", "input", NULL) ) {
-			lua_settop( base_engine_state, 0 );
-			return;
+		if ( replay_get_mode() == REPLAY_PLAYBACK ) {
+			continue;
+		}
+		if ( replay_get_mode() == REPLAY_RECORD ) {
+			replay_record( game_frame, &e );
+		}
+		/* Events with no handler are still taken off the queue, or an
+		 * idle loop would wake on them again straight away */
+		game_dispatch( &e );
+	}
+	if ( replay_get_mode() == REPLAY_PLAYBACK ) {
+		while ( replay_next(game_frame, &e) ) {
+			game_dispatch( &e );
 		}
+		if ( replay_finished(game_frame) ) {
+			quit( 0 );
+		}
+	}
+	++game_frame;
+}
+
+Uint32 game_get_ticks( )
+{
+	if ( replay_get_mode() != REPLAY_OFF ) {
+		return (Uint32)( (Uint64)game_frame * 1000 / base_fps );
+	}
+	return SDL_GetTicks( );
+}
+
+static Uint64 game_get_counter( )
+{
+	if ( replay_get_mode() != REPLAY_OFF ) {
+		return (Uint64)game_frame * SDL_GetPerformanceFrequency() / base_fps;
+	}
+	return SDL_GetPerformanceCounter( );
+}
+
+/* rate is in updates per second; 0 returns to one update per frame.
+ * At most max_steps updates run per frame, and time beyond that is
+ * dropped so a slow frame cannot snowball into slower ones. */
+void game_set_timestep( double rate, int max_steps )
+{
+	if ( rate > 0 ) {
+		game_step = (Uint64)( SDL_GetPerformanceFrequency() / rate );
+		game_step_ms = 1000.0 / rate;
+	} else {
+		game_step = 0;
+		game_step_ms = 0;
+	}
+	game_max_steps = max_steps > 0 ? max_steps : 1;
+	game_accumulator = 0;
+	game_last = game_get_counter( );
+	game_time = game_get_ticks( );
+}
+
+double game_get_timestep( )
+{
+	return game_step ? 1000.0 / game_step_ms : 0;
+}
 
-		lua_createtable( base_engine_state, 0, 5 );
-		switch( e.type ) {
-		case SDL_KEYDOWN:
-		case SDL_KEYUP:
-			luacom_write_table( base_engine_state, 2, "ssb",
-				"type", "keyboard",
-				"key", SDL_GetKeyName(e.key.keysym.sym),
-				"pressed", (e.type == SDL_KEYDOWN)
-			);
-			break;
-		case SDL_MOUSEBUTTONDOWN:
-		case SDL_MOUSEBUTTONUP:
-			luacom_write_table( base_engine_state, 2, "siiib",
-				"type", "mouse",
-				"button", (e.button.button == SDL_BUTTON_LEFT) ? 1 : (
-					(e.button.button == SDL_BUTTON_MIDDLE) ? 2 : 3 ),
-				"x", e.button.x,
-				"y", e.button.y,
-				"pressed", e.type == SDL_MOUSEBUTTONDOWN
-			);
-			break;
-		case SDL_TEXTEDITING:
-			luacom_write_table( base_engine_state, 2, "ssii",
-				"type", "text edit",
-				"text", e.edit.text,
-				"start", e.edit.start,
-				"length", e.edit.length
-			);
-			break;
-		case SDL_TEXTINPUT:
-			luacom_write_table( base_engine_state, 2, "ss",
-				"type", "text input",
-				"text", e.text.text
-			);
-			break;
-		case SDL_MOUSEWHEEL:
-			luacom_write_table( base_engine_state, 2, "ti",
-				"type", "wheel",
-				"direction", (e.wheel.y ? 1 : 2)
-			);
-			break;
-		/*case SDL_MOUSEMOTION:
-			luacom_write_table( base_engine_state, 2, "sii",
-				"type", "motion",
-				"xrel", e.motion.xrel,
-				"yrel", e.motion.yrel
-			);
-			break;
-		*/
-		default:
-			break;
+const struct game_stats *game_get_stats( )
+{
+	return &game_stats;
+}
+
+static void game_call_update( double time )
+{
+	if ( game_push_event(GAME_EVENT_UPDATE) ) {
+		if ( game_step == 0 ) {
+			lua_pushinteger( base_engine_state, (lua_Integer)time );
+		} else {
+			lua_pushnumber( base_engine_state, time );
 		}
 		lua_call( base_engine_state, 1, 0 );
-		lua_settop( base_engine_state, 0 );
 	}
+	lua_settop( base_engine_state, 0 );
 }
 
+/* update may call moonbase.setTimestep, which resets the clock; the step
+ * is consumed before each call and the loop ends as soon as the step
+ * changes, so the new settings take over from the next frame. */
 void game_update( )
 {
-	if ( luacom_get_global_field(base_engine_state, "moonbase", "event", "update", NULL) ) {
-		lua_pushinteger( base_engine_state, SDL_GetTicks() );
+	Uint64 now, step;
+	double step_ms;
+	int steps, max_steps;
+
+	if ( game_step == 0 ) {
+		game_call_update( game_get_ticks() );
+		game_stats.steps = 1;
+		return;
+	}
+	step = game_step;
+	step_ms = game_step_ms;
+	max_steps = game_max_steps;
+	now = game_get_counter( );
+	game_accumulator += now - game_last;
+	game_last = now;
+	for ( steps = 0; game_accumulator >= step && steps < max_steps; ) {
+		game_time += step_ms;
+		game_accumulator -= step;
+		++steps;
+		game_call_update( game_time );
+		if ( game_step != step ) {
+			game_stats.steps = steps;
+			return;
+		}
+	}
+	if ( game_accumulator >= step ) {
+		game_stats.dropped += (int)( game_accumulator / step );
+		game_accumulator %= step;
+	}
+	game_stats.steps = steps;
+}
+
+void game_set_idle( int idle )
+{
+	game_idle = idle;
+}
+
+int game_is_idle( )
+{
+	return game_idle && replay_get_mode() == REPLAY_OFF;
+}
+
+/* Blocks until an event is queued or the yielded game thread is due to
+ * resume. The event is left in the queue for game_input. */
+void game_wait( )
+{
+	Uint64 start;
+	Uint32 now;
+
+	start = SDL_GetPerformanceCounter( );
+	if ( base_resume_time ) {
+		now = SDL_GetTicks( );
+		if ( base_resume_time > now ) {
+			SDL_WaitEventTimeout( NULL, base_resume_time - now );
+		}
+	} else {
+		SDL_WaitEvent( NULL );
+	}
+	game_stats.wakeups++;
+	game_stats.idle_time += ( SDL_GetPerformanceCounter() - start ) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+/* Calls moonbase.event.render with how far the clock is between the
+ * last update and the next, for interpolating positions. */
+void game_render( )
+{
+	double alpha;
+
+	if ( game_push_event(GAME_EVENT_RENDER) ) {
+		alpha = game_step ? (double)game_accumulator / game_step : 1;
+		lua_pushnumber( base_engine_state, alpha );
 		lua_call( base_engine_state, 1, 0 );
 	}
 	lua_settop( base_engine_state, 0 );
 }
 
+/* Calls moonbase.event.lowMemory with the bytes in use and the budget */
+void game_low_memory( size_t used, size_t limit )
+{
+	if ( game_push_event(GAME_EVENT_LOW_MEMORY) ) {
+		lua_pushnumber( base_engine_state, (lua_Number)used );
+		lua_pushnumber( base_engine_state, (lua_Number)limit );
+		lua_call( base_engine_state, 2, 0 );
+	}
+	lua_settop( base_engine_state, 0 );
+}
+
 void game_shutdown( )
 {
-	if ( luacom_get_global_field(base_engine_state, "moonbase", "event", "shutdown", NULL) ) {
+	if ( game_push_event(GAME_EVENT_SHUTDOWN) ) {
 		lua_call( base_engine_state, 0, 0 );
 	}
 	video_stop_window( );
 	audio_stop_mixer( );
 	lua_settop( base_engine_state, 0 );
+	replay_stop( game_frame );
 }
@@ -0,0 +1,97 @@
+#include "moonbase.h"
+
+/*
+ * In driven mode the collector is stopped, so allocation debt never
+ * steps it in the middle of a script callback, and the engine runs
+ * incremental steps itself once a frame has been presented, for as long
+ * as the frame deadline and the maximum pause allow. At least one step
+ * is run every frame so a cycle always makes progress, even when no idle
+ * time is left. Should the heap still outgrow the steps, a full
+ * collection at the end of the frame is the backstop.
+ */
+#define GC_BACKSTOP_GROWTH	400	/* percent of the heap after the last cycle */
+#define GC_BACKSTOP_MIN		1024	/* KB, so a small heap is not collected every frame */
+
+static double		gc_max_pause;
+static int		gc_backstop;	/* in KB */
+static struct gc_stats	gc_stats;
+
+static void gc_set_backstop( )
+{
+	gc_backstop = (int)( (double)lua_gc(base_engine_state, LUA_GCCOUNT, 0) * GC_BACKSTOP_GROWTH / 100 );
+	if ( gc_backstop < GC_BACKSTOP_MIN ) {
+		gc_backstop = GC_BACKSTOP_MIN;
+	}
+}
+
+/* max_pause is in milliseconds; 0 returns the collector to its own pacing */
+void gc_set_max_pause( double max_pause )
+{
+	if ( max_pause > 0 && gc_max_pause == 0 ) {
+		lua_gc( base_engine_state, LUA_GCSTOP, 0 );
+		gc_set_backstop( );
+	} else if ( max_pause == 0 && gc_max_pause > 0 ) {
+		lua_gc( base_engine_state, LUA_GCRESTART, 0 );
+	}
+	gc_max_pause = max_pause;
+}
+
+double gc_get_max_pause( )
+{
+	return gc_max_pause;
+}
+
+void gc_step( )
+{
+	Uint64 frequency, start, limit, now, before, step;
+	double budget, left;
+
+	/* Without a pause budget the collector paces itself, and a script
+	 * that stopped it expects it to stay stopped, so the gc phase only
+	 * covers work done here while the engine drives it */
+	if ( gc_max_pause == 0 ) {
+		return;
+	}
+	budget = gc_max_pause;
+	left = pacer_get_time_left( );
+	if ( budget > 0 && left >= 0 && left < budget ) {
+		budget = left;
+	}
+	frequency = SDL_GetPerformanceFrequency( );
+	start = SDL_GetPerformanceCounter( );
+	limit = start + (Uint64)( budget * frequency / 1000.0 );
+	now = start;
+	/* A finished cycle ends the slice; the next frame starts the next */
+	do {
+		before = now;
+		gc_stats.steps++;
+		if ( lua_gc(base_engine_state, LUA_GCSTEP, 0) ) {
+			gc_stats.cycles++;
+			gc_set_backstop( );
+			now = SDL_GetPerformanceCounter( );
+			break;
+		}
+		now = SDL_GetPerformanceCounter( );
+		/* The last step predicts the next one, so the slice stops
+		 * before overrunning the limit */
+		step = now - before;
+	} while ( now + step < limit );
+	if ( lua_gc(base_engine_state, LUA_GCCOUNT, 0) > gc_backstop ) {
+		lua_gc( base_engine_state, LUA_GCCOLLECT, 0 );
+		gc_stats.cycles++;
+		gc_stats.backstops++;
+		gc_set_backstop( );
+		now = SDL_GetPerformanceCounter( );
+	}
+	gc_stats.time += ( now - start ) * 1000.0 / frequency;
+}
+
+const struct gc_stats *gc_get_stats( )
+{
+	return &gc_stats;
+}
+
+void gc_reset_stats( )
+{
+	memset( &gc_stats, 0, sizeof(gc_stats) );
+}
@@ -0,0 +1,643 @@
+#include "moonbase.h"
+
+/*
+ * Point, Vec2 and Rect are small userdata values for geometry that would
+ * otherwise be passed around as { x, y } and { x, y, w, h } tables. Points
+ * and rectangles hold integers like struct point and struct rectangle;
+ * Vec2 holds numbers for movement and physics. Fields can be read and
+ * written directly, so a script can keep one value and update it each
+ * frame instead of building new ones.
+ */
+
+struct vec2 { lua_Number x, y; };
+
+static struct point *geometry_push_point( lua_State *s, int x, int y )
+{
+	struct point p;
+
+	p.x = x;
+	p.y = y;
+	return (struct point*)luacom_create_object( s, &moonbase_point_class, &p, sizeof(p) );
+}
+
+static struct vec2 *geometry_push_vec2( lua_State *s, lua_Number x, lua_Number y )
+{
+	struct vec2 v;
+
+	v.x = x;
+	v.y = y;
+	return (struct vec2*)luacom_create_object( s, &moonbase_vec2_class, &v, sizeof(v) );
+}
+
+static struct rectangle *geometry_push_rect( lua_State *s, const struct rectangle *r )
+{
+	return (struct rectangle*)luacom_create_object( s, &moonbase_rect_class, r, sizeof(*r) );
+}
+
+/* Reads a point given as a Point, a Vec2, an { x, y } array or the loose
+ * numbers x, y; returns the index of the next argument. */
+int geometry_check_point( lua_State *s, int index, struct point *p )
+{
+	struct point *q;
+	struct vec2 *v;
+
+	if ( (q = (struct point*)luacom_test_object(s, index, &moonbase_point_class)) != NULL ) {
+		*p = *q;
+		return index + 1;
+	}
+	if ( (v = (struct vec2*)luacom_test_object(s, index, &moonbase_vec2_class)) != NULL ) {
+		/* Also false for NaN, which dividing by zero can give */
+		luaL_argcheck( s, v->x >= INT_MIN && v->x <= INT_MAX && v->y >= INT_MIN && v->y <= INT_MAX,
+			index, "vector has no integer position" );
+		p->x = (int)v->x;
+		p->y = (int)v->y;
+		return index + 1;
+	}
+	return luacom_check_point( s, index, &p->x, &p->y );
+}
+
+/* Reads a rectangle given as a Rect, an array or loose numbers as for
+ * luacom_check_rect, or as a Point or Vec2 with no size. */
+int geometry_check_rect( lua_State *s, int index, struct rectangle *r, int *sized )
+{
+	struct rectangle *q;
+	struct point p;
+
+	if ( (q = (struct rectangle*)luacom_test_object(s, index, &moonbase_rect_class)) != NULL ) {
+		*r = *q;
+		*sized = 1;
+		return index + 1;
+	}
+	if ( lua_type(s, index) == LUA_TUSERDATA ) {
+		index = geometry_check_point( s, index, &p );
+		r->x = p.x;
+		r->y = p.y;
+		r->w = 0;
+		r->h = 0;
+		*sized = 0;
+		return index;
+	}
+	return luacom_check_rect( s, index, &r->x, &r->y, &r->w, &r->h, sized );
+}
+
+/* Shared __index for the types: single letter fields come from the
+ * value, anything else from the methods in the metatable. */
+static int geometry_index( lua_State *s, const char *fields, const lua_Number *values, int integral )
+{
+	const char *key, *f;
+
+	key = lua_type( s, 2 ) == LUA_TSTRING ? lua_tostring( s, 2 ) : NULL;
+	if ( key != NULL && key[0] != 0 && key[1] == 0 && (f = SDL_strchr(fields, key[0])) != NULL ) {
+		if ( integral ) {
+			lua_pushinteger( s, (lua_Integer)values[ f - fields ] );
+		} else {
+			lua_pushnumber( s, values[ f - fields ] );
+		}
+		return 1;
+	}
+	lua_getmetatable( s, 1 );
+	lua_pushvalue( s, 2 );
+	lua_rawget( s, -2 );
+	return 1;
+}
+
+/* Returns the position of the field named by the key at index 2 */
+static int geometry_field( lua_State *s, const char *fields )
+{
+	const char *key, *f;
+
+	key = luaL_checkstring( s, 2 );
+	if ( key[0] == 0 || key[1] != 0 || (f = SDL_strchr(fields, key[0])) == NULL ) {
+		return luaL_error( s, "no field %s", key );
+	}
+	return (int)( f - fields );
+}
+
+static int moonbase_point_index( lua_State *s )
+{
+	struct point *p;
+	lua_Number values[ 2 ];
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	values[0] = p->x;
+	values[1] = p->y;
+	return geometry_index( s, "xy", values, 1 );
+}
+
+static int moonbase_point_newindex( lua_State *s )
+{
+	struct point *p;
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	*( geometry_field(s, "xy") ? &p->y : &p->x ) = luaL_checkint( s, 3 );
+	return 0;
+}
+
+static int moonbase_point_set( lua_State *s )
+{
+	struct point *p;
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	geometry_check_point( s, 2, p );
+	lua_settop( s, 1 );
+	return 1;
+}
+
+static int moonbase_point_unpack( lua_State *s )
+{
+	struct point *p;
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	lua_pushinteger( s, p->x );
+	lua_pushinteger( s, p->y );
+	return 2;
+}
+
+static int moonbase_point_clone( lua_State *s )
+{
+	struct point *p;
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	geometry_push_point( s, p->x, p->y );
+	return 1;
+}
+
+/* Point arithmetic is done wide so a result outside int range raises an
+ * error instead of wrapping */
+static void geometry_push_wide_point( lua_State *s, Sint64 x, Sint64 y )
+{
+	if ( x < INT_MIN || x > INT_MAX || y < INT_MIN || y > INT_MAX ) {
+		luaL_error( s, "point is out of integer range" );
+	}
+	geometry_push_point( s, (int)x, (int)y );
+}
+
+static int moonbase_point_add( lua_State *s )
+{
+	struct point a, b;
+
+	geometry_check_point( s, 1, &a );
+	geometry_check_point( s, 2, &b );
+	geometry_push_wide_point( s, (Sint64)a.x + b.x, (Sint64)a.y + b.y );
+	return 1;
+}
+
+static int moonbase_point_sub( lua_State *s )
+{
+	struct point a, b;
+
+	geometry_check_point( s, 1, &a );
+	geometry_check_point( s, 2, &b );
+	geometry_push_wide_point( s, (Sint64)a.x - b.x, (Sint64)a.y - b.y );
+	return 1;
+}
+
+static int moonbase_point_unm( lua_State *s )
+{
+	struct point *p;
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	geometry_push_wide_point( s, -(Sint64)p->x, -(Sint64)p->y );
+	return 1;
+}
+
+static int moonbase_point_eq( lua_State *s )
+{
+	struct point *a, *b;
+
+	a = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	b = (struct point*)luacom_check_object( s, 2, &moonbase_point_class );
+	lua_pushboolean( s, a->x == b->x && a->y == b->y );
+	return 1;
+}
+
+static int moonbase_point_tostring( lua_State *s )
+{
+	struct point *p;
+
+	p = (struct point*)luacom_check_object( s, 1, &moonbase_point_class );
+	lua_pushfstring( s, "Point(%d, %d)", p->x, p->y );
+	return 1;
+}
+
+luaL_Reg moonbase_point_methods[] = {
+	{ "set", moonbase_point_set },
+	{ "unpack", moonbase_point_unpack },
+	{ "clone", moonbase_point_clone },
+	{ "__index", moonbase_point_index },
+	{ "__newindex", moonbase_point_newindex },
+	{ "__add", moonbase_point_add },
+	{ "__sub", moonbase_point_sub },
+	{ "__unm", moonbase_point_unm },
+	{ "__eq", moonbase_point_eq },
+	{ "__tostring", moonbase_point_tostring },
+	{ NULL, NULL }
+};
+
+struct luacom_class moonbase_point_class = { "moonbase_point", moonbase_point_methods };
+
+/* Vec2 operands may be any point-like value; Points convert exactly */
+static void geometry_check_vec2( lua_State *s, int index, struct vec2 *v )
+{
+	struct vec2 *u;
+	struct point p;
+
+	if ( (u = (struct vec2*)luacom_test_object(s, index, &moonbase_vec2_class)) != NULL ) {
+		*v = *u;
+		return;
+	}
+	geometry_check_point( s, index, &p );
+	v->x = p.x;
+	v->y = p.y;
+}
+
+static int moonbase_vec2_index( lua_State *s )
+{
+	struct vec2 *v;
+	lua_Number values[ 2 ];
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	values[0] = v->x;
+	values[1] = v->y;
+	return geometry_index( s, "xy", values, 0 );
+}
+
+static int moonbase_vec2_newindex( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	*( geometry_field(s, "xy") ? &v->y : &v->x ) = luaL_checknumber( s, 3 );
+	return 0;
+}
+
+static int moonbase_vec2_set( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	if ( lua_type(s, 2) == LUA_TNUMBER ) {
+		v->x = luaL_checknumber( s, 2 );
+		v->y = luaL_checknumber( s, 3 );
+	} else {
+		geometry_check_vec2( s, 2, v );
+	}
+	lua_settop( s, 1 );
+	return 1;
+}
+
+static int moonbase_vec2_unpack( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	lua_pushnumber( s, v->x );
+	lua_pushnumber( s, v->y );
+	return 2;
+}
+
+static int moonbase_vec2_clone( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	geometry_push_vec2( s, v->x, v->y );
+	return 1;
+}
+
+static int moonbase_vec2_length( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	lua_pushnumber( s, SDL_sqrt(v->x * v->x + v->y * v->y) );
+	return 1;
+}
+
+static int moonbase_vec2_dot( lua_State *s )
+{
+	struct vec2 a, b;
+
+	geometry_check_vec2( s, 1, &a );
+	geometry_check_vec2( s, 2, &b );
+	lua_pushnumber( s, a.x * b.x + a.y * b.y );
+	return 1;
+}
+
+/* Returns a unit vector in the same direction; the zero vector stays zero */
+static int moonbase_vec2_normalize( lua_State *s )
+{
+	struct vec2 *v;
+	lua_Number length;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	length = SDL_sqrt( v->x * v->x + v->y * v->y );
+	if ( length > 0 ) {
+		geometry_push_vec2( s, v->x / length, v->y / length );
+	} else {
+		geometry_push_vec2( s, 0, 0 );
+	}
+	return 1;
+}
+
+static int moonbase_vec2_add( lua_State *s )
+{
+	struct vec2 a, b;
+
+	geometry_check_vec2( s, 1, &a );
+	geometry_check_vec2( s, 2, &b );
+	geometry_push_vec2( s, a.x + b.x, a.y + b.y );
+	return 1;
+}
+
+static int moonbase_vec2_sub( lua_State *s )
+{
+	struct vec2 a, b;
+
+	geometry_check_vec2( s, 1, &a );
+	geometry_check_vec2( s, 2, &b );
+	geometry_push_vec2( s, a.x - b.x, a.y - b.y );
+	return 1;
+}
+
+/* Scales by a number on either side, or multiplies componentwise */
+static int moonbase_vec2_mul( lua_State *s )
+{
+	struct vec2 a, b;
+
+	if ( lua_type(s, 1) == LUA_TNUMBER ) {
+		lua_insert( s, 1 );
+	}
+	geometry_check_vec2( s, 1, &a );
+	if ( lua_type(s, 2) == LUA_TNUMBER ) {
+		b.x = b.y = lua_tonumber( s, 2 );
+	} else {
+		geometry_check_vec2( s, 2, &b );
+	}
+	geometry_push_vec2( s, a.x * b.x, a.y * b.y );
+	return 1;
+}
+
+static int moonbase_vec2_div( lua_State *s )
+{
+	struct vec2 a;
+	lua_Number d;
+
+	geometry_check_vec2( s, 1, &a );
+	d = luaL_checknumber( s, 2 );
+	geometry_push_vec2( s, a.x / d, a.y / d );
+	return 1;
+}
+
+static int moonbase_vec2_unm( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	geometry_push_vec2( s, -v->x, -v->y );
+	return 1;
+}
+
+static int moonbase_vec2_eq( lua_State *s )
+{
+	struct vec2 *a, *b;
+
+	a = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	b = (struct vec2*)luacom_check_object( s, 2, &moonbase_vec2_class );
+	lua_pushboolean( s, a->x == b->x && a->y == b->y );
+	return 1;
+}
+
+static int moonbase_vec2_tostring( lua_State *s )
+{
+	struct vec2 *v;
+
+	v = (struct vec2*)luacom_check_object( s, 1, &moonbase_vec2_class );
+	lua_pushfstring( s, "Vec2(%f, %f)", v->x, v->y );
+	return 1;
+}
+
+luaL_Reg moonbase_vec2_methods[] = {
+	{ "set", moonbase_vec2_set },
+	{ "unpack", moonbase_vec2_unpack },
+	{ "clone", moonbase_vec2_clone },
+	{ "length", moonbase_vec2_length },
+	{ "dot", moonbase_vec2_dot },
+	{ "normalize", moonbase_vec2_normalize },
+	{ "__index", moonbase_vec2_index },
+	{ "__newindex", moonbase_vec2_newindex },
+	{ "__add", moonbase_vec2_add },
+	{ "__sub", moonbase_vec2_sub },
+	{ "__mul", moonbase_vec2_mul },
+	{ "__div", moonbase_vec2_div },
+	{ "__unm", moonbase_vec2_unm },
+	{ "__eq", moonbase_vec2_eq },
+	{ "__tostring", moonbase_vec2_tostring },
+	{ NULL, NULL }
+};
+
+struct luacom_class moonbase_vec2_class = { "moonbase_vec2", moonbase_vec2_methods };
+
+static int moonbase_rect_index( lua_State *s )
+{
+	struct rectangle *r;
+	lua_Number values[ 4 ];
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	values[0] = r->x;
+	values[1] = r->y;
+	values[2] = r->w;
+	values[3] = r->h;
+	return geometry_index( s, "xywh", values, 1 );
+}
+
+static int moonbase_rect_newindex( lua_State *s )
+{
+	struct rectangle *r;
+	int *fields[ 4 ];
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	fields[0] = &r->x;
+	fields[1] = &r->y;
+	fields[2] = &r->w;
+	fields[3] = &r->h;
+	*fields[ geometry_field(s, "xywh") ] = luaL_checkint( s, 3 );
+	return 0;
+}
+
+static int moonbase_rect_set( lua_State *s )
+{
+	struct rectangle *r;
+	int sized;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	geometry_check_rect( s, 2, r, &sized );
+	lua_settop( s, 1 );
+	return 1;
+}
+
+static int moonbase_rect_unpack( lua_State *s )
+{
+	struct rectangle *r;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	lua_pushinteger( s, r->x );
+	lua_pushinteger( s, r->y );
+	lua_pushinteger( s, r->w );
+	lua_pushinteger( s, r->h );
+	return 4;
+}
+
+static int moonbase_rect_clone( lua_State *s )
+{
+	struct rectangle *r;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	geometry_push_rect( s, r );
+	return 1;
+}
+
+/* rect:contains( point ) or rect:contains( x, y ) */
+static int moonbase_rect_contains( lua_State *s )
+{
+	struct rectangle *r;
+	struct point p;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	geometry_check_point( s, 2, &p );
+	lua_pushboolean( s, p.x >= r->x && p.y >= r->y && p.x < r->x + r->w && p.y < r->y + r->h );
+	return 1;
+}
+
+static int moonbase_rect_intersects( lua_State *s )
+{
+	struct rectangle *r, o;
+	int sized;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	geometry_check_rect( s, 2, &o, &sized );
+	lua_pushboolean( s, SDL_HasIntersection((SDL_Rect*)r, (SDL_Rect*)&o) );
+	return 1;
+}
+
+/* Returns the overlapping area, or nil if there is none */
+static int moonbase_rect_intersection( lua_State *s )
+{
+	struct rectangle *r, o, result;
+	int sized;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	geometry_check_rect( s, 2, &o, &sized );
+	if ( !SDL_IntersectRect((SDL_Rect*)r, (SDL_Rect*)&o, (SDL_Rect*)&result) ) {
+		lua_pushnil( s );
+		return 1;
+	}
+	geometry_push_rect( s, &result );
+	return 1;
+}
+
+static int moonbase_rect_union( lua_State *s )
+{
+	struct rectangle *r, o, result;
+	int sized;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	geometry_check_rect( s, 2, &o, &sized );
+	SDL_UnionRect( (SDL_Rect*)r, (SDL_Rect*)&o, (SDL_Rect*)&result );
+	geometry_push_rect( s, &result );
+	return 1;
+}
+
+static int moonbase_rect_eq( lua_State *s )
+{
+	struct rectangle *a, *b;
+
+	a = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	b = (struct rectangle*)luacom_check_object( s, 2, &moonbase_rect_class );
+	lua_pushboolean( s, a->x == b->x && a->y == b->y && a->w == b->w && a->h == b->h );
+	return 1;
+}
+
+static int moonbase_rect_tostring( lua_State *s )
+{
+	struct rectangle *r;
+
+	r = (struct rectangle*)luacom_check_object( s, 1, &moonbase_rect_class );
+	lua_pushfstring( s, "Rect(%d, %d, %d, %d)", r->x, r->y, r->w, r->h );
+	return 1;
+}
+
+luaL_Reg moonbase_rect_methods[] = {
+	{ "set", moonbase_rect_set },
+	{ "unpack", moonbase_rect_unpack },
+	{ "clone", moonbase_rect_clone },
+	{ "contains", moonbase_rect_contains },
+	{ "intersects", moonbase_rect_intersects },
+	{ "intersection", moonbase_rect_intersection },
+	{ "union", moonbase_rect_union },
+	{ "__index", moonbase_rect_index },
+	{ "__newindex", moonbase_rect_newindex },
+	{ "__eq", moonbase_rect_eq },
+	{ "__tostring", moonbase_rect_tostring },
+	{ NULL, NULL }
+};
+
+struct luacom_class moonbase_rect_class = { "moonbase_rect", moonbase_rect_methods };
+
+/* geometry.point( x, y ), geometry.point( { x, y } ) and so on; missing
+ * values default to 0 */
+static int moonbase_geometry_point( lua_State *s )
+{
+	struct point p;
+
+	if ( lua_isnoneornil(s, 1) ) {
+		p.x = p.y = 0;
+	} else {
+		geometry_check_point( s, 1, &p );
+	}
+	geometry_push_point( s, p.x, p.y );
+	return 1;
+}
+
+static int moonbase_geometry_vec2( lua_State *s )
+{
+	struct vec2 v;
+
+	if ( lua_isnoneornil(s, 1) ) {
+		v.x = v.y = 0;
+	} else if ( lua_type(s, 1) == LUA_TNUMBER ) {
+		v.x = luaL_checknumber( s, 1 );
+		v.y = luaL_checknumber( s, 2 );
+	} else {
+		geometry_check_vec2( s, 1, &v );
+	}
+	geometry_push_vec2( s, v.x, v.y );
+	return 1;
+}
+
+static int moonbase_geometry_rect( lua_State *s )
+{
+	struct rectangle r;
+	int sized;
+
+	if ( lua_isnoneornil(s, 1) ) {
+		SDL_zero( r );
+	} else {
+		geometry_check_rect( s, 1, &r, &sized );
+	}
+	geometry_push_rect( s, &r );
+	return 1;
+}
+
+static luaL_Reg moonbase_geometry_methods[] = {
+	{ "point", moonbase_geometry_point },
+	{ "vec2", moonbase_geometry_vec2 },
+	{ "rect", moonbase_geometry_rect },
+	{ NULL, NULL }
+};
+
+int moonbase_geometry_initialize( lua_State *s )
+{
+	luaL_newlib( s, moonbase_geometry_methods );
+	return 1;
+}
@@ -1,21 +1,32 @@
 #include "moonbase.h"
 
-void image_draw( const struct rectangle *dst, void *image )
-{
-	SDL_Texture *texture;
-	struct rectangle real_dst;
+static struct sprite	*image_batch;
+static int		image_batch_capacity;
 
-	texture = asset_image_handle( image );
-	memcpy( &real_dst, dst, sizeof(real_dst) );
-	if ( dst->w == 0 && dst->h == 0 ) {
-		SDL_QueryTexture( texture, NULL, NULL, &real_dst.w, &real_dst.h );
+/* Returns the shared scratch array of at least count sprites. Its
+ * contents only last until the next call, which render_sprites allows
+ * as it copies the sprites into the current buffer. */
+struct sprite *image_reserve_batch( int count )
+{
+	if ( count <= image_batch_capacity ) {
+		return image_batch;
+	}
+	for ( image_batch_capacity = 64; image_batch_capacity < count; image_batch_capacity *= 2 );
+	image_batch = (struct sprite*)SDL_realloc( image_batch, image_batch_capacity * sizeof(struct sprite) );
+	if ( image_batch == NULL ) {
+		fatal( "Failed to allocate sprite batch of %d sprites\n", count );
 	}
-	SDL_RenderCopy( video_renderer, texture, NULL, (SDL_Rect*)&real_dst );
+	return image_batch;
+}
+
+void image_draw( const struct rectangle *dst, void *image )
+{
+	render_copy( image, NULL, dst );
 }
 
 void image_draw_background( void *image )
 {
-	SDL_RenderCopy( video_renderer, asset_image_handle(image), NULL, NULL );
+	render_background( image );
 }
 
 void image_draw_clip( const struct rectangle *dst, void *image, const struct rectangle *src )
@@ -27,7 +38,12 @@ void image_draw_clip( const struct rectangle *dst, void *image, const struct rec
 		real_dst.w = src->w;
 		real_dst.h = src->h;
 	}
-	SDL_RenderCopy( video_renderer, asset_image_handle(image), (const SDL_Rect*)src, (SDL_Rect*)&real_dst );
+	render_copy( image, src, &real_dst );
+}
+
+void image_draw_batch( void *image, const struct sprite *sprites, int count )
+{
+	render_sprites( image, sprites, count );
 }
 
 void image_get_size( void *image, struct size *size )
@@ -38,6 +54,66 @@ void image_get_size( void *image, struct size *size )
 	SDL_QueryTexture( asset_image_handle(image), &format, &access, &size->w, &size->h );
 }
 
+/* Whether a canvas of size is positive and within the renderer's
+ * texture size limit, if it has one */
+int image_canvas_fits( const struct size *size )
+{
+	SDL_RendererInfo info;
+
+	if ( size->w <= 0 || size->h <= 0 ) {
+		return 0;
+	}
+	if ( SDL_GetRendererInfo(video_renderer, &info) != 0 ) {
+		return 1;
+	}
+	return ( info.max_texture_width == 0 || size->w <= info.max_texture_width ) &&
+		( info.max_texture_height == 0 || size->h <= info.max_texture_height );
+}
+
+/* Canvases are images backed by a render target texture; drawing calls
+ * made between image_begin_canvas and image_end_canvas land in the
+ * texture instead of the frame. The texture is updated when the canvas
+ * is ended, so a canvas drawn earlier in the same frame shows its new
+ * contents. Returns NULL with the SDL error set if the texture cannot be
+ * created. */
+void *image_create_canvas( const struct size *size )
+{
+	SDL_Texture *texture;
+	struct render_buffer empty;
+
+	if ( !image_canvas_fits(size) ) {
+		SDL_SetError( "%dx%d is larger than the renderer allows", size->w, size->h );
+		return NULL;
+	}
+	texture = SDL_CreateTexture( video_renderer, SDL_PIXELFORMAT_RGBA8888,
+		SDL_TEXTUREACCESS_TARGET, size->w, size->h );
+	if ( texture == NULL ) {
+		return NULL;
+	}
+	SDL_SetTextureBlendMode( texture, SDL_BLENDMODE_BLEND );
+	memset( &empty, 0, sizeof(empty) );
+	render_to_texture( &empty, texture, 1 );
+	return asset_create( NULL, texture, ASSET_IMAGE );
+}
+
+int image_is_canvas( void *image )
+{
+	int access;
+
+	SDL_QueryTexture( asset_image_handle(image), NULL, &access, NULL, NULL );
+	return ( access == SDL_TEXTUREACCESS_TARGET );
+}
+
+int image_begin_canvas( void *image )
+{
+	return render_begin_target( asset_image_handle(image) );
+}
+
+int image_end_canvas( void *image )
+{
+	return render_end_target( asset_image_handle(image), 0 );
+}
+
 float image_get_alpha( void *image )
 {
 	Uint8 alpha;
@@ -54,20 +130,15 @@ void image_set_alpha( void *image, float alpha )
 	SDL_SetTextureAlphaMod( asset_image_handle(image), alpha_int );
 }
 
+/* image:draw( destination ) or image:draw( x, y [, w, h] ) */
 static int moonbase_image_draw( lua_State *s )
 {
 	void *image;
 	struct rectangle r;
+	int sized;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
-	luacom_read_array( s, 2, "ii", 1, &r.x, 2, &r.y );
-	lua_len( s, 2 );
-	if ( lua_tointeger(s, -1) == 4 ) {
-		luacom_read_array( s, 2, "ii", 3, &r.w, 4, &r.h );
-	} else {
-		r.w = 0;
-		r.h = 0;
-	}
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	geometry_check_rect( s, 2, &r, &sized );
 	image_draw( &r, image );
 	return 0;
 }
@@ -76,55 +147,145 @@ static int moonbase_image_draw_background( lua_State *s )
 {
 	void *image;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
 	image_draw_background( image );
 	return 0;
 }
 
+/* image:drawClip( destination, source ), or with either rectangle
+ * given as loose numbers. The source always needs a size; a destination
+ * without one takes the source's. When both are loose numbers the source
+ * is the last four, so the destination is x, y or x, y, w, h. */
 static int moonbase_image_draw_clip( lua_State *s )
 {
 	void *image;
 	struct rectangle src, dst;
+	int n, next, sized;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
-	luacom_read_array( s, 2, "ii", 1, &dst.x, 2, &dst.y );
-	lua_len( s, 2 );
-	if ( lua_tointeger(s, -1) == 4 ) {
-		luacom_read_array( s, 2, "ii", 3, &dst.w, 4, &dst.h );
-	} else {
-		dst.w = 0;
-		dst.h = 0;
-	}
-	luacom_read_array( s, 3, "ii", 1, &src.x, 2, &src.y );
-	lua_len( s, 3 );
-	if ( lua_tointeger(s, -1) == 4 ) {
-		luacom_read_array( s, 3, "ii", 3, &src.w, 4, &src.h );
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	for ( n = 0; lua_type(s, 2 + n) == LUA_TNUMBER; ++n );
+	if ( n > 0 && lua_isnoneornil(s, 2 + n) ) {
+		luaL_argcheck( s, n == 6 || n == 8, 2, "expected destination x, y [, w, h] and source x, y, w, h" );
+		if ( n == 6 ) {
+			next = luacom_check_point( s, 2, &dst.x, &dst.y );
+			dst.w = 0;
+			dst.h = 0;
+		} else {
+			next = luacom_check_rect( s, 2, &dst.x, &dst.y, &dst.w, &dst.h, &sized );
+		}
+		luacom_check_rect( s, next, &src.x, &src.y, &src.w, &src.h, &sized );
 	} else {
-		src.w = 0;
-		src.h = 0;
+		next = geometry_check_rect( s, 2, &dst, &sized );
+		geometry_check_rect( s, next, &src, &sized );
+		luaL_argcheck( s, sized, next, "source rectangle must have a size" );
 	}
 	image_draw_clip( &dst, image, &src );
 	return 0;
 }
 
+/* Bounds of each drawBatch record field: the rectangles are ints, the
+ * tint a Uint32 and the angle a float */
+static const lua_Number image_batch_min[ IMAGE_BATCH_STRIDE ] = {
+	INT_MIN, INT_MIN, INT_MIN, INT_MIN, INT_MIN, INT_MIN, INT_MIN, INT_MIN, 0, -FLT_MAX
+};
+static const lua_Number image_batch_max[ IMAGE_BATCH_STRIDE ] = {
+	INT_MAX, INT_MAX, INT_MAX, INT_MAX, INT_MAX, INT_MAX, INT_MAX, INT_MAX, 0xFFFFFFFF, FLT_MAX
+};
+
+static int moonbase_image_draw_batch( lua_State *s )
+{
+	void *image;
+	struct sprite *sp;
+	int i, n, count, isnum;
+	lua_Number field[ IMAGE_BATCH_STRIDE ];
+
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	luaL_checktype( s, 2, LUA_TTABLE );
+	n = lua_rawlen( s, 2 );
+	luaL_argcheck( s, n % IMAGE_BATCH_STRIDE == 0, 2, "incomplete sprite record" );
+	count = n / IMAGE_BATCH_STRIDE;
+	for ( sp = image_reserve_batch(count), n = 1; n <= count * IMAGE_BATCH_STRIDE; ++sp ) {
+		for ( i = 0; i < IMAGE_BATCH_STRIDE; ++i, ++n ) {
+			lua_rawgeti( s, 2, n );
+			field[i] = lua_tonumberx( s, -1, &isnum );
+			if ( !isnum ) {
+				luaL_argerror( s, 2, lua_pushfstring(s, "number expected at [%d], got %s", n, luaL_typename(s, -1)) );
+			}
+			/* Also false for NaN */
+			if ( !(field[i] >= image_batch_min[i] && field[i] <= image_batch_max[i]) ) {
+				luaL_argerror( s, 2, lua_pushfstring(s, "value out of range at [%d]", n) );
+			}
+			lua_pop( s, 1 );
+		}
+		sp->destination.x = (int)field[0];
+		sp->destination.y = (int)field[1];
+		sp->destination.w = (int)field[2];
+		sp->destination.h = (int)field[3];
+		sp->source.x = (int)field[4];
+		sp->source.y = (int)field[5];
+		sp->source.w = (int)field[6];
+		sp->source.h = (int)field[7];
+		sp->tint = (Uint32)(lua_Unsigned)field[8];
+		sp->angle = (float)field[9];
+	}
+	image_draw_batch( image, image_reserve_batch(count), count );
+	return 0;
+}
+
+static int moonbase_image_begin( lua_State *s )
+{
+	void *image;
+
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	if ( !image_is_canvas(image) ) {
+		return luaL_error( s, "image is not a canvas" );
+	}
+	if ( image_begin_canvas(image) ) {
+		return luaL_error( s, "canvases nested too deeply" );
+	}
+	return 0;
+}
+
+static int moonbase_image_finish( lua_State *s )
+{
+	void *image;
+
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	if ( image_end_canvas(image) ) {
+		return luaL_error( s, "canvas is not being drawn to" );
+	}
+	return 0;
+}
+
 static int moonbase_image_get_size( lua_State *s )
 {
 	void *image;
 	struct size size;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
 	image_get_size( image, &size );
-	lua_createtable( s, 0, 2 );
-	luacom_write_array( s, -1, "ii", 1, size.w, 2, size.h );
+	luacom_fill_size( s, 2, size.w, size.h );
 	return 1;
 }
 
+static int moonbase_image_get_dimensions( lua_State *s )
+{
+	void *image;
+	struct size size;
+
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	image_get_size( image, &size );
+	lua_pushinteger( s, size.w );
+	lua_pushinteger( s, size.h );
+	return 2;
+}
+
 static int moonbase_image_get_alpha( lua_State *s )
 {
 	void *image;
 	float alpha;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
 	alpha = image_get_alpha( image );
 	lua_pushnumber( s, alpha );
 	return 1;
@@ -135,7 +296,7 @@ static int moonbase_image_set_alpha( lua_State *s )
 	void *image;
 	float alpha;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
 	alpha = luaL_checknumber( s, 2 );
 	image_set_alpha( image, alpha );
 	return 0;
@@ -145,7 +306,7 @@ static int moonbase_image_gc( lua_State *s )
 {
 	void *image;
 
-	image = *(void**)luaL_checkudata( s, 1, "moonbase_image" );
+	image = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
 	asset_release( image );
 	return 0;
 }
@@ -154,13 +315,19 @@ luaL_Reg moonbase_image_methods[] = {
 	{ "draw", moonbase_image_draw },
 	{ "drawBackground", moonbase_image_draw_background },
 	{ "drawClip", moonbase_image_draw_clip },
+	{ "drawBatch", moonbase_image_draw_batch },
+	{ "begin", moonbase_image_begin },
+	{ "finish", moonbase_image_finish },
 	{ "getSize", moonbase_image_get_size },
+	{ "getDimensions", moonbase_image_get_dimensions },
 	{ "getAlpha", moonbase_image_get_alpha },
 	{ "setAlpha", moonbase_image_set_alpha },
 	{ "__gc", moonbase_image_gc },
 	{ NULL, NULL }
 };
 
+struct luacom_class moonbase_image_class = { "moonbase_image", moonbase_image_methods };
+
 int moonbase_image_initialize( lua_State *s )
 {
 	luaL_newlib( s, moonbase_image_methods );
@@ -0,0 +1,203 @@
+#include "moonbase.h"
+
+static struct layer	*layer_list;
+
+struct layer *layer_new( const struct size *size, const char *name )
+{
+	struct layer *layer;
+
+	layer = (struct layer*)SDL_calloc( 1, sizeof(struct layer) );
+	if ( layer == NULL ) {
+		fatal( "Failed to allocate layer\n" );
+	}
+	layer->image = image_create_canvas( size );
+	layer->size = *size;
+	layer->dirty = 1;
+	layer->key = LUA_NOREF;
+	SDL_strlcpy( layer->name, name != NULL ? name : "", sizeof(layer->name) );
+	layer->next = layer_list;
+	layer_list = layer;
+	return layer;
+}
+
+void layer_free( struct layer *layer )
+{
+	struct layer **p;
+
+	for ( p = &layer_list; *p != NULL; p = &(*p)->next ) {
+		if ( *p == layer ) {
+			*p = layer->next;
+			break;
+		}
+	}
+	if ( layer->image != NULL ) {
+		asset_release( layer->image );
+	}
+	SDL_free( layer );
+}
+
+void layer_invalidate( struct layer *layer )
+{
+	layer->dirty = 1;
+}
+
+void layer_invalidate_all( )
+{
+	struct layer *layer;
+
+	for ( layer = layer_list; layer != NULL; layer = layer->next ) {
+		layer->dirty = 1;
+	}
+}
+
+/* Frees every layer's texture; each is recreated and re-recorded the
+ * next time it is drawn. */
+void layer_release_all( )
+{
+	struct layer *layer;
+
+	for ( layer = layer_list; layer != NULL; layer = layer->next ) {
+		if ( layer->image != NULL ) {
+			asset_release( layer->image );
+			layer->image = NULL;
+		}
+		layer->dirty = 1;
+	}
+}
+
+int layer_begin( struct layer *layer )
+{
+	if ( layer->image == NULL ) {
+		layer->image = image_create_canvas( &layer->size );
+		if ( layer->image == NULL ) {
+			return -1;
+		}
+	}
+	if ( render_begin_target(asset_image_handle(layer->image)) ) {
+		return -1;
+	}
+	layer->misses++;
+	return 0;
+}
+
+int layer_end( struct layer *layer )
+{
+	if ( render_end_target(asset_image_handle(layer->image), 1) ) {
+		return -1;
+	}
+	layer->dirty = 0;
+	return 0;
+}
+
+void layer_draw( struct layer *layer, const struct rectangle *dst )
+{
+	render_copy( layer->image, NULL, dst );
+}
+
+struct layer *layer_next( struct layer *layer )
+{
+	return layer == NULL ? layer_list : layer->next;
+}
+
+/* layer:draw( destination, fn [, key] ) calls fn to re-record the layer
+ * when it is dirty or key differs from the previous call's key, then
+ * draws the cached texture. */
+static int moonbase_layer_draw( lua_State *s )
+{
+	struct layer *layer;
+	struct rectangle r;
+	int changed, status, sized;
+
+	layer = *(struct layer**)luacom_check_object( s, 1, &moonbase_layer_class );
+	luaL_argcheck( s, lua_type(s, 2) != LUA_TNUMBER, 2, "destination must be a single value" );
+	geometry_check_rect( s, 2, &r, &sized );
+	if ( !sized ) {
+		r.w = layer->size.w;
+		r.h = layer->size.h;
+	}
+	luaL_checktype( s, 3, LUA_TFUNCTION );
+	lua_settop( s, 4 );
+	lua_rawgeti( s, LUA_REGISTRYINDEX, layer->key );
+	changed = !lua_rawequal( s, 4, 5 );
+	lua_pop( s, 1 );
+	if ( changed ) {
+		luaL_unref( s, LUA_REGISTRYINDEX, layer->key );
+		lua_pushvalue( s, 4 );
+		layer->key = luaL_ref( s, LUA_REGISTRYINDEX );
+	}
+	if ( layer->dirty || changed ) {
+		if ( layer_begin(layer) ) {
+			if ( layer->image == NULL ) {
+				return luaL_error( s, "failed to create layer texture: %s", SDL_GetError() );
+			}
+			return luaL_error( s, "layers nested too deeply" );
+		}
+		lua_pushvalue( s, 3 );
+		status = lua_pcall( s, 0, 0, 0 );
+		layer_end( layer );
+		if ( status != LUA_OK ) {
+			layer->dirty = 1;
+			return lua_error( s );
+		}
+	} else {
+		layer->hits++;
+	}
+	layer_draw( layer, &r );
+	return 0;
+}
+
+static int moonbase_layer_invalidate( lua_State *s )
+{
+	struct layer *layer;
+
+	layer = *(struct layer**)luacom_check_object( s, 1, &moonbase_layer_class );
+	layer_invalidate( layer );
+	return 0;
+}
+
+static int moonbase_layer_get_size( lua_State *s )
+{
+	struct layer *layer;
+
+	layer = *(struct layer**)luacom_check_object( s, 1, &moonbase_layer_class );
+	luacom_push_size( s, layer->size.w, layer->size.h );
+	return 1;
+}
+
+static int moonbase_layer_gc( lua_State *s )
+{
+	struct layer *layer;
+
+	layer = *(struct layer**)luacom_check_object( s, 1, &moonbase_layer_class );
+	luaL_unref( s, LUA_REGISTRYINDEX, layer->key );
+	layer_free( layer );
+	return 0;
+}
+
+luaL_Reg moonbase_layer_methods[] = {
+	{ "draw", moonbase_layer_draw },
+	{ "invalidate", moonbase_layer_invalidate },
+	{ "getSize", moonbase_layer_get_size },
+	{ "__gc", moonbase_layer_gc },
+	{ NULL, NULL }
+};
+
+struct luacom_class moonbase_layer_class = { "moonbase_layer", moonbase_layer_methods };
+
+int moonbase_video_layer( lua_State *s )
+{
+	struct layer *layer;
+	struct size size;
+
+	size.w = luaL_checkint( s, 1 );
+	size.h = luaL_checkint( s, 2 );
+	luaL_argcheck( s, size.w > 0 && size.h > 0, 1, "layer size must be positive" );
+	luaL_argcheck( s, image_canvas_fits(&size), 1, "layer larger than the maximum texture size" );
+	layer = layer_new( &size, luaL_optstring(s, 3, NULL) );
+	if ( layer->image == NULL ) {
+		layer_free( layer );
+		return luaL_error( s, "failed to create layer texture: %s", SDL_GetError() );
+	}
+	luacom_create_object( s, &moonbase_layer_class, &layer, sizeof(layer) );
+	return 1;
+}
@@ -155,17 +155,61 @@ void luacom_read_stack( lua_State *s, const char *format, ... )
 	va_end( v );
 }
 
-void luacom_create_object( lua_State *s, const char *classname, void *data, size_t data_size, const luaL_Reg *methods )
+/* Objects start with a pointer to their class, padded so the userdata
+ * after it stays aligned for any type. */
+union luacom_tag {
+	const struct luacom_class	*c;
+	double				d;
+	void				*p;
+	long				l;
+};
+
+void *luacom_create_object( lua_State *s, struct luacom_class *c, const void *data, size_t data_size )
 {
-	void *userdata;
+	union luacom_tag *tag;
 
-	userdata = lua_newuserdata( s, data_size );
-	memcpy( userdata, data, data_size );
-	luaL_newmetatable( s, classname );
-	luaL_setfuncs( s, methods, 0 );
-	lua_pushvalue( s, -1 );
-	lua_setfield( s, -2, "__index" );
+	if ( c->ref == 0 ) {
+		luaL_newmetatable( s, c->name );
+		luaL_setfuncs( s, c->methods, 0 );
+		lua_getfield( s, -1, "__index" );
+		if ( lua_isnil(s, -1) ) {
+			lua_pushvalue( s, -2 );
+			lua_setfield( s, -3, "__index" );
+		}
+		lua_pop( s, 1 );
+		c->ref = luaL_ref( s, LUA_REGISTRYINDEX );
+	}
+	tag = (union luacom_tag*)lua_newuserdata( s, sizeof(union luacom_tag) + data_size );
+	tag->c = c;
+	memcpy( tag + 1, data, data_size );
+	lua_rawgeti( s, LUA_REGISTRYINDEX, c->ref );
 	lua_setmetatable( s, -2 );
+	return tag + 1;
+}
+
+void *luacom_test_object( lua_State *s, int index, const struct luacom_class *c )
+{
+	union luacom_tag *tag;
+
+	if ( lua_type(s, index) == LUA_TUSERDATA && lua_rawlen(s, index) >= sizeof(union luacom_tag) ) {
+		tag = (union luacom_tag*)lua_touserdata( s, index );
+		if ( tag->c == c ) {
+			return tag + 1;
+		}
+	}
+	return NULL;
+}
+
+void *luacom_check_object( lua_State *s, int index, const struct luacom_class *c )
+{
+	void *userdata;
+
+	userdata = luacom_test_object( s, index, c );
+	if ( userdata != NULL ) {
+		return userdata;
+	}
+	luaL_argerror( s, index, lua_pushfstring(s, "%s expected, got %s", c->name, luaL_typename(s, index)) );
+	return NULL;
 }
 
 int luacom_get_global_field( lua_State *s, const char *global, ... )
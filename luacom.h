@@ -10,6 +10,7 @@
 #define LUACOM_H
 
 #include <stdarg.h>
+#include <limits.h>
 #include <string.h>
 #ifndef LUA_COMPAT_APIINTCASTS
 #define LUA_COMPAT_APIINTCASTS
@@ -118,20 +119,207 @@ void	luacom_append_stack( lua_State *s, const char *format, ... );
  **********************************************************/
 void	luacom_read_stack( lua_State *s, const char *format, ... );
 
+/***********************************************************
+ * luacom_read_point, luacom_read_rect
+ *
+ * Read an { x, y } or { x, y, w, h } array of integers.
+ * These skip the format string and metamethods of
+ * luacom_read_array and sit on the drawing hot paths.
+ *
+ * s		= Lua state
+ * index	= Location of array
+ * x, y, w, h	= Pointers for the results
+ *
+ * luacom_read_rect accepts a two element array too, and
+ * then sets w and h to 0 and returns 0; otherwise it
+ * returns 1.
+ *
+ **********************************************************/
+static inline int luacom_read_element( lua_State *s, int index, int i )
+{
+	lua_Integer value;
+	int isnum;
+
+	lua_rawgeti( s, index, i );
+	value = lua_tointegerx( s, -1, &isnum );
+	if ( !isnum ) {
+		luaL_argerror( s, index, lua_pushfstring(s, "number expected at [%d], got %s", i, luaL_typename(s, -1)) );
+	}
+	if ( value < INT_MIN || value > INT_MAX ) {
+		luaL_argerror( s, index, lua_pushfstring(s, "value out of range at [%d]", i) );
+	}
+	lua_pop( s, 1 );
+	return (int)value;
+}
+
+static inline void luacom_read_point( lua_State *s, int index, int *x, int *y )
+{
+	luaL_checktype( s, index, LUA_TTABLE );
+	*x = luacom_read_element( s, index, 1 );
+	*y = luacom_read_element( s, index, 2 );
+}
+
+static inline int luacom_read_rect( lua_State *s, int index, int *x, int *y, int *w, int *h )
+{
+	luacom_read_point( s, index, x, y );
+	if ( lua_rawlen(s, index) < 4 ) {
+		*w = 0;
+		*h = 0;
+		return 0;
+	}
+	*w = luacom_read_element( s, index, 3 );
+	*h = luacom_read_element( s, index, 4 );
+	return 1;
+}
+
+/***********************************************************
+ * luacom_push_point, luacom_push_size
+ *
+ * Push a new { x, y } or { w, h } array, created at its
+ * final size
+ *
+ * s		= Lua state
+ *
+ **********************************************************/
+static inline void luacom_push_point( lua_State *s, int x, int y )
+{
+	lua_createtable( s, 2, 0 );
+	lua_pushinteger( s, x );
+	lua_rawseti( s, -2, 1 );
+	lua_pushinteger( s, y );
+	lua_rawseti( s, -2, 2 );
+}
+
+#define luacom_push_size( s, w, h )	luacom_push_point( (s), (w), (h) )
+
+/***********************************************************
+ * luacom_fill_point, luacom_fill_size
+ *
+ * Like luacom_push_point, but fill and push the table at
+ * out instead if there is one, so getters can be called
+ * every frame without making garbage
+ *
+ * s		= Lua state
+ * out		= Location of an optional table to reuse
+ *
+ **********************************************************/
+static inline void luacom_fill_point( lua_State *s, int out, int x, int y )
+{
+	if ( !lua_istable(s, out) ) {
+		luacom_push_point( s, x, y );
+		return;
+	}
+	lua_pushvalue( s, out );
+	lua_pushinteger( s, x );
+	lua_rawseti( s, -2, 1 );
+	lua_pushinteger( s, y );
+	lua_rawseti( s, -2, 2 );
+}
+
+#define luacom_fill_size( s, out, w, h )	luacom_fill_point( (s), (out), (w), (h) )
+
+/***********************************************************
+ * luacom_check_point, luacom_check_rect
+ *
+ * Like luacom_read_point and luacom_read_rect, but the
+ * value may also be passed as loose numbers x, y [, w, h]
+ * starting at index, which saves scripts building a table
+ * per call. w and h are only read if a number follows y.
+ *
+ * Return the index of the argument after the value;
+ * luacom_check_rect sets *sized to whether w and h were
+ * given.
+ *
+ **********************************************************/
+static inline int luacom_check_point( lua_State *s, int index, int *x, int *y )
+{
+	if ( lua_type(s, index) != LUA_TNUMBER ) {
+		luacom_read_point( s, index, x, y );
+		return index + 1;
+	}
+	*x = luaL_checkint( s, index );
+	*y = luaL_checkint( s, index + 1 );
+	return index + 2;
+}
+
+static inline int luacom_check_rect( lua_State *s, int index, int *x, int *y, int *w, int *h, int *sized )
+{
+	if ( lua_type(s, index) != LUA_TNUMBER ) {
+		*sized = luacom_read_rect( s, index, x, y, w, h );
+		return index + 1;
+	}
+	*x = luaL_checkint( s, index );
+	*y = luaL_checkint( s, index + 1 );
+	if ( lua_type(s, index + 2) != LUA_TNUMBER ) {
+		*w = 0;
+		*h = 0;
+		*sized = 0;
+		return index + 2;
+	}
+	*w = luaL_checkint( s, index + 2 );
+	*h = luaL_checkint( s, index + 3 );
+	*sized = 1;
+	return index + 4;
+}
+
+/***********************************************************
+ * struct luacom_class
+ *
+ * Describes a userdata type. Declare one statically per
+ * type with only name and methods filled in; the metatable
+ * is built the first time an object of the type is made
+ * and kept in the registry from then on. Methods are found
+ * through the metatable itself unless methods has its own
+ * __index.
+ *
+ * name		= Name of userdata type
+ * methods	= Methods that operate on the userdata
+ *
+ **********************************************************/
+struct luacom_class {
+	const char	*name;
+	const luaL_Reg	*methods;
+	int		ref;
+};
+
 /***********************************************************
  * luacom_create_object 
  *
- * Create a userdata object with methods
+ * Create a userdata object of a class and push it
  *
  * s		= Lua state
- * classname	= Name of userdata type
+ * c		= Class of the object
  * udata	= Pointer to userdata
  * udata_size	= Size of userdata
- * methods	= Methods that operate on the userdata
- 		(use luaL_checkudata to retrieve the userdata)
+ *
+ * Returns the object's copy of the userdata
+ *
+ **********************************************************/
+void	*luacom_create_object( lua_State *s, struct luacom_class *c, const void *udata, size_t udata_size );
+
+/***********************************************************
+ * luacom_check_object 
+ *
+ * Retrieve the userdata of an object, raising an argument
+ * error if the value is not an object of the class. Objects
+ * are tagged with their class, so this is a pointer
+ * comparison rather than a metatable lookup by name.
+ *
+ * s		= Lua state
+ * index	= Location of object
+ * c		= Expected class of the object
+ *
+ **********************************************************/
+void	*luacom_check_object( lua_State *s, int index, const struct luacom_class *c );
+
+/***********************************************************
+ * luacom_test_object 
+ *
+ * Like luacom_check_object, but return NULL instead of
+ * raising an error
  *
  **********************************************************/
-void	luacom_create_object( lua_State *s, const char *classname, void *udata, size_t udata_size, const luaL_Reg *methods );
+void	*luacom_test_object( lua_State *s, int index, const struct luacom_class *c );
 
 /***********************************************************
  * luacom_get_global_field 
@@ -1,11 +1,31 @@
 #include "moonbase.h"
 
+static void report( )
+{
+	const struct pacer_stats *pacer;
+	double seconds;
+
+	pacer = pacer_get_stats( );
+	seconds = pacer->mean * pacer->frames / 1000.0;
+	printf( "%d frames in %.3f s (%.1f fps)\n", pacer->frames, seconds,
+		seconds > 0 ? pacer->frames / seconds : 0.0 );
+	printf( "frame time: mean %.3f ms, jitter %.3f ms, max %.3f ms\n",
+		pacer->mean, pacer->jitter, pacer->max );
+}
+
 void quit( int sig )
 {
 	if ( sig != -1 ) {
 		game_shutdown( );
 	}
+	if ( sig == 0 && (base_headless || base_frame_limit) ) {
+		report( );
+	}
+	trace_shutdown( );
+	profiler_stop( );
+	profiler_stop_allocations( );
 	video_shutdown( );
+	render_shutdown( );
 	audio_shutdown( );
 	base_shutdown( );
 	exit( 0 );
@@ -14,44 +34,86 @@ void quit( int sig )
 void initialize( int argc, char *argv[] )
 {
 	base_initialize( argc, argv );
+	if ( base_trace_path != NULL ) {
+		trace_start( base_trace_path );
+	}
+	if ( base_profile_path != NULL ) {
+		profiler_start( base_profile_path, 0 );
+	}
+	if ( base_alloc_profile_path != NULL ) {
+		profiler_start_allocations( base_alloc_profile_path, 0 );
+	}
+	if ( base_gc_pause > 0 ) {
+		gc_set_max_pause( base_gc_pause );
+	}
+	pacer_initialize( );
+	timing_initialize( );
 	audio_initialize( );
 	video_initialize( );
+	render_initialize( );
 	game_initialize( );
 	signal( SIGINT, quit );
 	signal( SIGTERM, quit );
 }
 
-void frame( )
+/* Returns 0 if only the game thread was resumed and no frame was drawn */
+int frame( )
 {
-	Uint32 start, elapsed, delay;
-
-	start = SDL_GetTicks( );
-
-	if ( base_resume_time && start >= base_resume_time ) {
+	if ( base_resume_time && game_get_ticks() >= base_resume_time ) {
 		base_resume_time = 0;
 		lua_settop( base_game_state, 0 );
-		lua_resume( base_game_state, base_engine_state, 0 );
-		return;
+		base_resume( 0 );
+		return 0;
 	}
 
+	TRACE_BEGIN( "frame" );
+	timing_begin_frame( );
+	TRACE_BEGIN( "input" );
 	game_input( );
+	TRACE_END( );
+	timing_mark( TIMING_INPUT );
+	TRACE_BEGIN( "update" );
 	game_update( );
+	game_render( );
+	TRACE_END( );
+	timing_mark( TIMING_UPDATE );
+	TRACE_BEGIN( "submit" );
+	render_submit( );
+	TRACE_END( );
+	timing_mark( TIMING_SUBMIT );
+	TRACE_BEGIN( "present" );
 	video_render( );
-
-	delay = 1000 / base_fps;
-	elapsed = SDL_GetTicks() - start;
-
-	if ( elapsed < delay ) {
-		SDL_Delay( delay - elapsed );
+	TRACE_END( );
+	timing_mark( TIMING_PRESENT );
+	TRACE_BEGIN( "gc" );
+	gc_step( );
+	TRACE_END( );
+	memory_check( );
+	timing_mark( TIMING_GC );
+	timing_end_frame( );
+	if ( trace_enabled ) {
+		trace_end_script_zones( );
+	}
+	TRACE_END( );
+	if ( !game_is_idle() ) {
+		pacer_wait( );
 	}
+	return 1;
 }
 
 int main( int argc, char *argv[] )
 {
+	int frames;
+
 	initialize( argc, argv );
-	for ( ;; ) {
-		frame( );
+	pacer_reset_stats( );
+	for ( frames = 0; base_frame_limit == 0 || frames < base_frame_limit; ) {
+		if ( game_is_idle() && !base_headless ) {
+			game_wait( );
+		}
+		frames += frame( );
 	}
+	quit( 0 );
 
 	return 0;
 }
@@ -0,0 +1,118 @@
+#include "moonbase.h"
+
+/*
+ * With a memory budget the engine state's allocator is wrapped, and any
+ * allocation that would take the Lua heap past the limit is refused.
+ * Lua answers a refusal with an emergency full collection and one retry
+ * before raising a memory error. Before it comes to that, memory_check
+ * runs once a frame and escalates as usage passes MEMORY_PRESSURE
+ * percent of the budget. It runs a full collection, then calls
+ * moonbase.event.lowMemory so the game can let go of what it holds. The
+ * event fires once and is re-armed when usage falls back below
+ * MEMORY_RELIEF percent.
+ *
+ * The render caches live outside the Lua heap, so dropping them cannot
+ * relieve the budget or a talloc pool. They are only dropped when the
+ * system allocator under Lua has run out, where their memory may be what
+ * is missing, and at most once every MEMORY_DROP_INTERVAL milliseconds,
+ * as every layer and tilemap chunk is rendered again after a drop.
+ */
+#define MEMORY_PRESSURE		90
+#define MEMORY_RELIEF		75
+#define MEMORY_DROP_INTERVAL	5000
+
+static lua_Alloc		memory_alloc_original;
+static void			*memory_alloc_ud;
+static size_t			memory_pressure, memory_relief;
+static int			memory_refused;
+static int			memory_starved;
+static int			memory_warned;
+static Uint32			memory_dropped_at;
+static struct memory_stats	memory_stats;
+
+static void *memory_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+	void *p;
+
+	if ( ptr == NULL ) {
+		osize = 0;
+	}
+	if ( nsize > osize && memory_stats.used + (nsize - osize) > memory_stats.limit ) {
+		memory_stats.refusals++;
+		memory_refused = 1;
+		return NULL;
+	}
+	p = memory_alloc_original( memory_alloc_ud, ptr, osize, nsize );
+	if ( p == NULL && nsize > 0 ) {
+		/* The allocator underneath ran out, e.g. a full talloc pool */
+		memory_stats.refusals++;
+		memory_refused = 1;
+		memory_starved = base_pool == NULL;
+		return NULL;
+	}
+	memory_stats.used += nsize - osize;
+	if ( memory_stats.used > memory_stats.peak ) {
+		memory_stats.peak = memory_stats.used;
+	}
+	return p;
+}
+
+/* limit is in bytes; call right after the engine state is created */
+void memory_initialize( size_t limit )
+{
+	memory_stats.limit = limit;
+	memory_pressure = limit / 100 * MEMORY_PRESSURE;
+	memory_relief = limit / 100 * MEMORY_RELIEF;
+	memory_stats.used = (size_t)lua_gc( base_engine_state, LUA_GCCOUNT, 0 ) * 1024
+		+ lua_gc( base_engine_state, LUA_GCCOUNTB, 0 );
+	memory_stats.peak = memory_stats.used;
+	memory_dropped_at = SDL_GetTicks( ) - MEMORY_DROP_INTERVAL;
+	memory_alloc_original = lua_getallocf( base_engine_state, &memory_alloc_ud );
+	lua_setallocf( base_engine_state, memory_alloc, NULL );
+}
+
+void memory_check( )
+{
+	if ( memory_stats.limit == 0 ) {
+		return;
+	}
+	if ( memory_stats.used < memory_relief ) {
+		memory_warned = 0;
+	}
+	if ( !memory_refused && (memory_stats.used < memory_pressure || memory_warned) ) {
+		return;
+	}
+	memory_refused = 0;
+	TRACE_BEGIN( "memory pressure" );
+	lua_gc( base_engine_state, LUA_GCCOLLECT, 0 );
+	memory_stats.collections++;
+	if ( memory_starved && SDL_GetTicks() - memory_dropped_at >= MEMORY_DROP_INTERVAL ) {
+		layer_release_all( );
+		tilemap_release_all( );
+		memory_stats.drops++;
+		memory_dropped_at = SDL_GetTicks( );
+	}
+	memory_starved = 0;
+	if ( memory_stats.used >= memory_pressure && !memory_warned ) {
+		memory_warned = 1;
+		memory_stats.warnings++;
+		log_printf( LOG_WARN, "Lua is using %lu of %lu bytes",
+			(unsigned long)memory_stats.used, (unsigned long)memory_stats.limit );
+		game_low_memory( memory_stats.used, memory_stats.limit );
+	}
+	TRACE_END( );
+}
+
+const struct memory_stats *memory_get_stats( )
+{
+	return &memory_stats;
+}
+
+void memory_reset_stats( )
+{
+	memory_stats.peak = memory_stats.used;
+	memory_stats.collections = 0;
+	memory_stats.drops = 0;
+	memory_stats.warnings = 0;
+	memory_stats.refusals = 0;
+}
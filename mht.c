@@ -160,6 +160,7 @@ void mht_delete(struct mht *t, void *k)
 	if (e->next) e->next->prev = e->prev;
 	if (e->prev) e->prev->next = e->next;
 	else t->table[idx] = e->next;
+	free(e);
 	--t->size;
 }
 
@@ -176,6 +177,7 @@ int mht_rehash(struct mht *t, size_t new_capacity)
 	t->table = new_table;
 	old_capacity = t->capacity;
 	t->capacity = new_capacity;
+	t->size = 0;
 	for (i = 0; i < old_capacity; ++i) {
 		if (!old_table[i]) continue;
 		for (ent = old_table[i]; ent; ent = next_ent) {
@@ -204,3 +206,169 @@ void mht_free(struct mht *t)
 	free(t->table);
 	free(t);
 }
+
+/*****************************************************************************
+ * cmht
+ ****************************************************************************/
+
+struct cmht *cmht_new(size_t shards, size_t initial_capacity,
+	mht_free_fn *free_fn, mht_hash_fn *hash_fn, mht_equals_fn *equals_fn)
+{
+	size_t i, n;
+	struct cmht *t;
+
+	for (n = 1; n < shards; n <<= 1);
+	t = (struct cmht*)malloc(sizeof(struct cmht));
+	if (!t) return 0;
+	if (posix_memalign((void**)&t->shards, CMHT_CACHE_LINE,
+	    n * sizeof(struct cmht_shard))) {
+		free(t);
+		return 0;
+	}
+	memset(t->shards, 0, n * sizeof(struct cmht_shard));
+	t->mask = n - 1;
+	t->hash_fn = hash_fn;
+	for (i = 0; i < n; ++i) {
+		t->shards[i].table = mht_new(initial_capacity / n + 1, free_fn,
+			hash_fn, equals_fn);
+		if (!t->shards[i].table ||
+		    pthread_rwlock_init(&t->shards[i].lock, 0)) {
+			if (t->shards[i].table) mht_free(t->shards[i].table);
+			t->mask = i - 1;
+			if (i) cmht_free(t);
+			else {
+				free(t->shards);
+				free(t);
+			}
+			return 0;
+		}
+	}
+	return t;
+}
+
+struct cmht *cmht_strk_new(size_t shards, size_t initial_capacity,
+	mht_free_fn *free_fn)
+{
+	return cmht_new(shards, initial_capacity, free_fn, mht_strk_hash,
+		mht_strk_equals);
+}
+
+struct cmht *cmht_ptrk_new(size_t shards, size_t initial_capacity,
+	mht_free_fn *free_fn)
+{
+	return cmht_new(shards, initial_capacity, free_fn, mht_ptrk_hash,
+		mht_ptrk_equals);
+}
+
+/* The shard tables index their buckets with hash % capacity, so the shard is
+ * picked from a remixed hash to keep the two choices independent. */
+static struct cmht_shard *cmht_shard_of(struct cmht *t, void *k)
+{
+	unsigned long int h;
+
+	h = t->hash_fn(k);
+	h ^= h >> 15;
+	h *= 0x2c1b3c6dUL;
+	h ^= h >> 12;
+	h *= 0x297a2d39UL;
+	h ^= h >> 15;
+	return &t->shards[h & t->mask];
+}
+
+void cmht_free(struct cmht *t)
+{
+	size_t i;
+
+	for (i = 0; i <= t->mask; ++i) {
+		pthread_rwlock_destroy(&t->shards[i].lock);
+		mht_free(t->shards[i].table);
+	}
+	free(t->shards);
+	free(t);
+}
+
+int cmht_set(struct cmht *t, void *k, void *v, int overwrite)
+{
+	int r;
+	struct cmht_shard *sh;
+
+	sh = cmht_shard_of(t, k);
+	pthread_rwlock_wrlock(&sh->lock);
+	r = mht_set(sh->table, k, v, overwrite);
+	pthread_rwlock_unlock(&sh->lock);
+	return r;
+}
+
+int cmht_get(struct cmht *t, void *k, void **v)
+{
+	int r;
+	struct cmht_shard *sh;
+
+	sh = cmht_shard_of(t, k);
+	pthread_rwlock_rdlock(&sh->lock);
+	r = mht_get(sh->table, k, v);
+	pthread_rwlock_unlock(&sh->lock);
+	return r;
+}
+
+/* Returns -1 if k is absent, 1 if fn asked for the entry to be deleted and
+ * 0 otherwise. */
+int cmht_update(struct cmht *t, void *k, cmht_update_fn *fn, void *arg)
+{
+	int r;
+	size_t idx;
+	struct mht_ent *e;
+	struct cmht_shard *sh;
+
+	sh = cmht_shard_of(t, k);
+	pthread_rwlock_wrlock(&sh->lock);
+	idx = sh->table->hash_fn(k) % sh->table->capacity;
+	e = mht_search_bucket(sh->table, idx, k);
+	if (!e) r = -1;
+	else if (fn(e->k, e->v, arg)) {
+		mht_delete(sh->table, k);
+		r = 1;
+	} else r = 0;
+	pthread_rwlock_unlock(&sh->lock);
+	return r;
+}
+
+/* Like cmht_update, but fn runs under the shard's read lock and must not
+ * modify the entry. Returns -1 if k is absent and fn's result otherwise. */
+int cmht_read(struct cmht *t, void *k, cmht_update_fn *fn, void *arg)
+{
+	int r;
+	size_t idx;
+	struct mht_ent *e;
+	struct cmht_shard *sh;
+
+	sh = cmht_shard_of(t, k);
+	pthread_rwlock_rdlock(&sh->lock);
+	idx = sh->table->hash_fn(k) % sh->table->capacity;
+	e = mht_search_bucket(sh->table, idx, k);
+	r = e ? fn(e->k, e->v, arg) : -1;
+	pthread_rwlock_unlock(&sh->lock);
+	return r;
+}
+
+void cmht_delete(struct cmht *t, void *k)
+{
+	struct cmht_shard *sh;
+
+	sh = cmht_shard_of(t, k);
+	pthread_rwlock_wrlock(&sh->lock);
+	mht_delete(sh->table, k);
+	pthread_rwlock_unlock(&sh->lock);
+}
+
+size_t cmht_size(struct cmht *t)
+{
+	size_t i, n;
+
+	for (i = 0, n = 0; i <= t->mask; ++i) {
+		pthread_rwlock_rdlock(&t->shards[i].lock);
+		n += mht_size(t->shards[i].table);
+		pthread_rwlock_unlock(&t->shards[i].lock);
+	}
+	return n;
+}
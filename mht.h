@@ -26,6 +26,7 @@
 #include <limits.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 struct mht_ent {
 	void *k;
@@ -61,5 +62,51 @@ int mht_get(struct mht *t, void *k, void **v);
 void mht_delete(struct mht *t, void *k);
 int mht_rehash(struct mht *t, size_t new_capacity);
 
+/*****************************************************************************
+ * cmht
+ * Thread-safe variant of mht. Keys are spread over a power of two number of
+ * shards, each of which is a plain mht guarded by its own reader-writer
+ * lock, so readers never block each other and writers only contend when
+ * they land on the same shard.
+ *****************************************************************************/
+
+/* Called with the shard write-locked; return nonzero to delete the entry. */
+typedef int (cmht_update_fn)(void *k, void *v, void *arg);
+
+/* Each shard is padded out to its own cache line, so threads locking
+ * neighbouring shards do not bounce a shared line between cores. */
+#define CMHT_CACHE_LINE 64
+
+struct cmht_shard {
+	pthread_rwlock_t lock;
+	struct mht *table;
+	char pad[CMHT_CACHE_LINE - (sizeof(pthread_rwlock_t) +
+		sizeof(struct mht*)) % CMHT_CACHE_LINE];
+};
+
+/* hash_fn is kept here rather than read from a shard, which would touch
+ * shard 0's lock line on every operation. */
+struct cmht {
+	size_t mask;
+	mht_hash_fn *hash_fn;
+	struct cmht_shard *shards;
+};
+
+#define cmht_shards(T)	((T)->mask + 1)
+
+struct cmht *cmht_new(size_t shards, size_t initial_capacity,
+	mht_free_fn *free_fn, mht_hash_fn *hash_fn, mht_equals_fn *equals_fn);
+struct cmht *cmht_strk_new(size_t shards, size_t initial_capacity,
+	mht_free_fn *free_fn);
+struct cmht *cmht_ptrk_new(size_t shards, size_t initial_capacity,
+	mht_free_fn *free_fn);
+void cmht_free(struct cmht *t);
+int cmht_set(struct cmht *t, void *k, void *v, int overwrite);
+int cmht_get(struct cmht *t, void *k, void **v);
+int cmht_update(struct cmht *t, void *k, cmht_update_fn *fn, void *arg);
+int cmht_read(struct cmht *t, void *k, cmht_update_fn *fn, void *arg);
+void cmht_delete(struct cmht *t, void *k);
+size_t cmht_size(struct cmht *t);
+
 #endif
 
@@ -2,6 +2,7 @@
 #define BASE_H
 
 #include <signal.h>
+#include <float.h>
 #ifndef LUA_COMPAT_APIINTCASTS
 #define LUA_COMPAT_APIINTCASTS
 #endif
@@ -73,6 +74,9 @@ void	quit( int sig );
  **********************************************************/
 
 extern int		base_pool_size;
+extern int		base_arena;
+extern double		base_gc_pause;
+extern int		base_memory_budget;
 extern char		*base_game_path;
 extern char		*base_data_path;
 extern char		*base_main_script;
@@ -80,12 +84,21 @@ extern char		*base_config_script;
 extern TALLOC_CTX	*base_pool;
 extern lua_State	*base_engine_state;
 extern lua_State	*base_game_state;
+extern lua_State	*base_running_state;
 extern unzFile		base_archive;
 extern int		base_fps;
 extern Uint32		base_resume_time;
+extern int		base_headless;
+extern int		base_frame_limit;
+extern char		*base_record_path;
+extern char		*base_replay_path;
+extern char		*base_trace_path;
+extern char		*base_profile_path;
+extern char		*base_alloc_profile_path;
 
 void	base_initialize( int argc, char *argv[] );
 void	base_shutdown( );
+int	base_resume( int nargs );
 
 char	*vstr( const char *fmt, ... );
 char	*joinpath( const char *base, const char *p );
@@ -96,9 +109,187 @@ char	*joinpath( const char *base, const char *p );
  **********************************************************/
 
 void	game_initialize( );
+void	game_install_events( lua_State *s, int index );
 void	game_shutdown( );
 void	game_input( );
 void	game_update( );
+void	game_render( );
+void	game_set_timestep( double rate, int max_steps );
+double	game_get_timestep( );
+void	game_set_idle( int idle );
+int	game_is_idle( );
+void	game_low_memory( size_t used, size_t limit );
+void	game_wait( );
+Uint32	game_get_ticks( );
+
+struct game_stats {
+	int	steps;
+	int	dropped;
+	int	wakeups;
+	double	idle_time;
+};
+
+const struct game_stats	*game_get_stats( );
+
+/***********************************************************
+ * pacer.c 
+ **********************************************************/
+
+/* Frame times are histogrammed in buckets of PACER_BUCKET_WIDTH
+ * milliseconds; the last bucket also counts anything longer. */
+#define PACER_BUCKETS		100
+#define PACER_BUCKET_WIDTH	0.5
+
+struct pacer_stats {
+	int	frames;
+	int	late;
+	double	mean, jitter, max;
+	int	histogram[ PACER_BUCKETS ];
+};
+
+void	pacer_initialize( );
+void	pacer_set_vsync( int refresh_rate );
+void	pacer_wait( );
+double	pacer_get_time_left( );
+void	pacer_reset_stats( );
+
+const struct pacer_stats	*pacer_get_stats( );
+
+/***********************************************************
+ * gc.c 
+ **********************************************************/
+
+struct gc_stats {
+	int	steps;
+	int	cycles;
+	int	backstops;
+	double	time;
+};
+
+void	gc_set_max_pause( double max_pause );
+double	gc_get_max_pause( );
+void	gc_step( );
+void	gc_reset_stats( );
+
+const struct gc_stats	*gc_get_stats( );
+
+/***********************************************************
+ * trace.c 
+ **********************************************************/
+
+/*
+ * Zones are written to a Chrome trace JSON file on quit. The macros
+ * cost a single branch while tracing is off; names must outlive the
+ * trace, so pass string literals or interned strings.
+ */
+
+extern int	trace_enabled;
+
+#define TRACE_BEGIN( name )	do { if ( trace_enabled ) trace_begin( name ); } while ( 0 )
+#define TRACE_END( )		do { if ( trace_enabled ) trace_end( ); } while ( 0 )
+
+void		trace_start( const char *path );
+void		trace_shutdown( );
+void		trace_begin( const char *name );
+void		trace_end( );
+void		trace_begin_script( const char *name );
+void		trace_end_script( );
+void		trace_end_script_zones( );
+const char	*trace_intern( const char *name );
+
+/***********************************************************
+ * arena.c 
+ **********************************************************/
+
+/* Bytes in use by the Lua state as it requested them; small counts
+ * blocks served from the size classes, reserved the chunks they are
+ * carved from. */
+struct arena_stats {
+	size_t	live, peak;
+	size_t	small, large;
+	size_t	reserved;
+};
+
+void	*arena_alloc( void *ud, void *ptr, size_t osize, size_t nsize );
+const struct arena_stats *arena_get_stats( );
+double	arena_get_fragmentation( );
+void	arena_shutdown( );
+
+/***********************************************************
+ * memory.c 
+ **********************************************************/
+
+/* Sizes are in bytes; peak is the high-water mark of the Lua heap since
+ * the engine started or the stats were last reset. */
+struct memory_stats {
+	size_t	used, peak, limit;
+	int	collections;
+	int	drops;
+	int	warnings;
+	int	refusals;
+};
+
+void	memory_initialize( size_t limit );
+void	memory_check( );
+void	memory_reset_stats( );
+
+const struct memory_stats	*memory_get_stats( );
+
+/***********************************************************
+ * profiler.c 
+ **********************************************************/
+
+void	profiler_start( const char *path, int interval );
+void	profiler_stop( );
+int	profiler_is_running( );
+void	profiler_start_allocations( const char *path, int rate );
+void	profiler_stop_allocations( );
+
+/***********************************************************
+ * timing.c 
+ **********************************************************/
+
+/* Percentiles are kept over the last TIMING_WINDOW frames */
+#define TIMING_WINDOW	256
+
+enum {
+	TIMING_INPUT,
+	TIMING_UPDATE,
+	TIMING_GC,
+	TIMING_SUBMIT,
+	TIMING_PRESENT,
+	TIMING_FRAME,
+	TIMING_PHASES
+};
+
+struct timing_percentiles {
+	float	p50, p95, p99, max;
+};
+
+void		timing_initialize( );
+void		timing_begin_frame( );
+void		timing_mark( int phase );
+void		timing_end_frame( );
+void		timing_get_percentiles( int phase, struct timing_percentiles *p );
+const char	*timing_get_name( int phase );
+
+/***********************************************************
+ * replay.c 
+ **********************************************************/
+
+enum {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAYBACK
+};
+
+void	replay_start_recording( const char *path );
+void	replay_start_playback( const char *path );
+void	replay_stop( Uint32 frame );
+int	replay_get_mode( );
+void	replay_record( Uint32 frame, const SDL_Event *e );
+int	replay_next( Uint32 frame, SDL_Event *e );
+int	replay_finished( Uint32 frame );
 
 /***********************************************************
  * asset.c 
@@ -115,7 +306,7 @@ struct asset {
 	void	*handle;
 	int	refcount;
 };
-struct asset	*asset_find( void *key );
+int		asset_find( void *key, struct asset *ent );
 
 void		asset_initialize( );
 void		asset_shutdown( );
@@ -179,6 +370,9 @@ int	sound_play( void *sound, int fade_ms, int loop );
 #define	channel_pause(C)	((void)(Mix_Pause((C))))
 #define	channel_resume(C)	((void)(Mix_Resume((C))))
 
+extern struct luacom_class	moonbase_sound_class;
+extern struct luacom_class	moonbase_channel_class;
+
 /***********************************************************
  * video.c 
  **********************************************************/
@@ -211,10 +405,10 @@ void	video_start_window( );
 void	video_stop_window( );
 
 #define video_restart( )		do { video_stop_window( ); video_start_window( ); } while ( 0 )
-#define	video_clear( )			((void)(SDL_RenderClear(video_renderer)))
-#define	video_draw_line(P,Q)		((void)(SDL_RenderDrawLine(video_renderer,(P)->x,(P)->y,(Q)->x,(Q)->y)))
-#define	video_draw_rectangle(R)		((void)(SDL_RenderDrawRect(video_renderer,(const SDL_Rect*)(R))))
-#define	video_fill_rectangle(R)		((void)(SDL_RenderFillRect(video_renderer,(const SDL_Rect*)(R))))
+#define	video_clear( )			(render_clear( ))
+#define	video_draw_line(P,Q)		(render_line((P),(Q)))
+#define	video_draw_rectangle(R)		(render_rect((R)))
+#define	video_fill_rectangle(R)		(render_fill_rect((R)))
 #define video_render( )			((void)(SDL_RenderPresent(video_renderer)))
 #define video_show_messagebox(M)	((void)(SDL_ShowSimpleMessageBox(0,"",(M),NULL)))
 
@@ -240,6 +434,119 @@ void	video_set_position( const struct point *position );
 void	video_set_size( const struct size *size );
 void	video_set_title( const char *title );
 
+/***********************************************************
+ * render.c 
+ **********************************************************/
+
+/*
+ * Drawing calls are recorded into the command buffer on top of
+ * the render stack (the per-frame buffer unless a static buffer
+ * is recording) and the frame buffer is submitted to SDL once,
+ * right before video_render. Consecutive draws of the same
+ * texture are merged into a single SDL_RenderGeometry call.
+ */
+
+enum {
+	RENDER_CLEAR,
+	RENDER_SPRITES,
+	RENDER_BACKGROUND,
+	RENDER_LINE,
+	RENDER_RECT,
+	RENDER_FILL_RECT,
+	RENDER_LINES,
+	RENDER_POINTS,
+	RENDER_RECTS,
+	RENDER_FILL_RECTS
+};
+
+/*
+ * Commands are submitted in layer order. Within a layer, draws
+ * recorded with RENDER_ORDER_PAINTER keep their recording order
+ * and come first; draws recorded with RENDER_ORDER_TEXTURE are
+ * grouped by texture, blend mode and alpha to cut state changes.
+ */
+enum {
+	RENDER_ORDER_PAINTER,
+	RENDER_ORDER_TEXTURE
+};
+
+struct render_command {
+	int			type;
+	SDL_Color		color;
+	SDL_Texture		*texture;
+	void			*image;
+	struct rectangle	rect;
+	int			first, count;
+	int			layer, order;
+	SDL_BlendMode		blend;
+	Uint8			alpha;
+};
+
+struct render_buffer {
+	struct render_command	*commands;
+	int			num_commands, max_commands;
+	SDL_Vertex		*vertices;
+	int			num_vertices, max_vertices;
+	SDL_Point		*points;
+	int			num_points, max_points;
+	SDL_Rect		*rects;
+	int			num_rects, max_rects;
+	int			retained;
+	SDL_Texture		*target;
+};
+
+struct render_stats {
+	int	commands;
+	int	draw_calls;
+	int	sprites;
+	int	state_changes;
+	int	unsorted_state_changes;
+};
+
+struct sprite;
+
+void	render_initialize( );
+void	render_shutdown( );
+void	render_reset( );
+void	render_submit( );
+void	render_destroy_texture( SDL_Texture *texture );
+void	render_set_draw_color( const SDL_Color *color );
+void	render_set_layer( int layer, int order );
+int	render_get_layer( );
+
+void	render_clear( );
+void	render_line( const struct point *p, const struct point *q );
+void	render_rect( const struct rectangle *r );
+void	render_fill_rect( const struct rectangle *r );
+void	render_copy( void *image, const struct rectangle *source, const struct rectangle *destination );
+void	render_background( void *image );
+void	render_sprites( void *image, const struct sprite *sprites, int count );
+
+/* Batched primitives: the storage returned by the reserve functions is
+ * filled in with count points or rectangles, which are then recorded by
+ * the matching push, with no other render call in between. Nothing is
+ * recorded if the push never comes. Lines are drawn as a connected strip
+ * through the points. */
+SDL_Point	*render_reserve_points_batch( int count );
+SDL_Rect	*render_reserve_rects_batch( int count );
+void		render_push_points( int type, int count );
+void		render_push_rects( int type, int count );
+
+struct render_buffer	*render_buffer_new( int retained );
+void			render_buffer_clear( struct render_buffer *b );
+void			render_buffer_free( struct render_buffer *b );
+void			render_buffer_release( struct render_buffer *b );
+int			render_begin( struct render_buffer *b );
+int			render_end( struct render_buffer *b );
+int			render_replay( struct render_buffer *b );
+void			render_to_texture( const struct render_buffer *b, SDL_Texture *target, int clear );
+int			render_begin_target( SDL_Texture *target );
+int			render_end_target( SDL_Texture *target, int clear );
+
+const struct render_stats	*render_get_stats( );
+
+extern struct luacom_class	moonbase_command_buffer_class;
+
 /***********************************************************
 * font.c 
 **********************************************************/
@@ -247,17 +554,113 @@ void	video_set_title( const char *title );
 void	font_get_render_size( void *font, const char *text, struct size *size );
 void	*font_render_text( void *font, const char *text, const char *color );
 
+extern struct luacom_class	moonbase_font_class;
+
 /***********************************************************
  * image.c 
  **********************************************************/
 
+/* Values per sprite record in image:drawBatch arrays:
+ * x, y, w, h, source x, source y, source w, source h, tint, angle */
+#define IMAGE_BATCH_STRIDE	10
+
+struct sprite {
+	struct rectangle	destination;
+	struct rectangle	source;
+	Uint32			tint;
+	float			angle;
+};
+
 void	image_draw( const struct rectangle *destination, void *image );
+void	image_draw_batch( void *image, const struct sprite *sprites, int count );
+struct sprite	*image_reserve_batch( int count );
 void	image_draw_background( void *image );
 void	image_draw_clip( const struct rectangle *destination, void *image, const struct rectangle *source );
 void	image_get_size( void *image, struct size *size );
+int	image_canvas_fits( const struct size *size );
+void	*image_create_canvas( const struct size *size );
+int	image_is_canvas( void *image );
+int	image_begin_canvas( void *image );
+int	image_end_canvas( void *image );
 float	image_get_alpha( void *image );
 void	image_set_alpha( void *image, float alpha );
 
+extern struct luacom_class	moonbase_image_class;
+
+/***********************************************************
+ * geometry.c 
+ **********************************************************/
+
+/* Read geometry arguments given as Point, Vec2 or Rect values, arrays
+ * or loose numbers; see luacom_check_point and luacom_check_rect. */
+int	geometry_check_point( lua_State *s, int index, struct point *p );
+int	geometry_check_rect( lua_State *s, int index, struct rectangle *r, int *sized );
+
+extern struct luacom_class	moonbase_point_class;
+extern struct luacom_class	moonbase_vec2_class;
+extern struct luacom_class	moonbase_rect_class;
+
+/***********************************************************
+ * tilemap.c 
+ **********************************************************/
+
+/*
+ * Tile 0 is empty; tile n, up to TILEMAP_MAX_TILE, is the nth tile of
+ * the atlas, counting left to right, top to bottom. Chunks of the map are cached in
+ * render target textures and re-rendered only when a tile in them
+ * changes.
+ */
+
+#define TILEMAP_MAX_TILE	65535
+
+struct tilemap;
+
+struct tilemap	*tilemap_new( void *atlas, const struct size *tile, int columns, int rows );
+void		tilemap_free( struct tilemap *map );
+void		tilemap_get_size( struct tilemap *map, struct size *size );
+int		tilemap_get( struct tilemap *map, int column, int row );
+void		tilemap_set( struct tilemap *map, int column, int row, int tile );
+void		tilemap_invalidate( struct tilemap *map );
+void		tilemap_release_all( );
+void		tilemap_draw( struct tilemap *map, const struct rectangle *camera, const struct point *position );
+
+extern struct luacom_class	moonbase_tilemap_class;
+
+/***********************************************************
+ * layer.c 
+ **********************************************************/
+
+/*
+ * A layer caches a group of draw calls in a render target texture.
+ * The calls are re-recorded only when the layer is invalidated or
+ * the key it was last drawn with changes; otherwise drawing the layer
+ * costs a single copy.
+ */
+
+#define LAYER_NAME_LENGTH	32
+
+struct layer {
+	void		*image;
+	struct size	size;
+	int		dirty;
+	int		key;
+	char		name[ LAYER_NAME_LENGTH ];
+	int		hits, misses;
+	struct layer	*next;
+};
+
+struct layer	*layer_new( const struct size *size, const char *name );
+void		layer_free( struct layer *layer );
+void		layer_invalidate( struct layer *layer );
+void		layer_invalidate_all( );
+void		layer_release_all( );
+int		layer_begin( struct layer *layer );
+int		layer_end( struct layer *layer );
+void		layer_draw( struct layer *layer, const struct rectangle *dst );
+struct layer	*layer_next( struct layer *layer );
+
+extern struct luacom_class	moonbase_layer_class;
+
 /***********************************************************
  * storage.c 
  **********************************************************/
@@ -0,0 +1,135 @@
+#include "moonbase.h"
+
+/* The final stretch before a deadline is spun rather than slept, since
+ * SDL_Delay can overshoot by a scheduler quantum. */
+#define PACER_SPIN_MICROSECONDS	1500
+
+static Uint64			pacer_frequency;
+static Uint64			pacer_deadline;
+static Uint64			pacer_remainder;
+static Uint64			pacer_last;
+static int			pacer_refresh_rate;
+static double			pacer_sum, pacer_sum_squares;
+static struct pacer_stats	pacer_stats;
+
+void pacer_initialize( )
+{
+	pacer_frequency = SDL_GetPerformanceFrequency( );
+	pacer_reset_stats( );
+}
+
+/* Called whenever a renderer is created; refresh_rate is the display
+ * refresh rate if presenting waits for the vertical blank, otherwise 0. */
+void pacer_set_vsync( int refresh_rate )
+{
+	pacer_refresh_rate = refresh_rate;
+}
+
+/* Also restarts the frame clock, so the next frame is measured from now */
+void pacer_reset_stats( )
+{
+	pacer_last = SDL_GetPerformanceCounter( );
+	pacer_deadline = pacer_last;
+	pacer_remainder = 0;
+	memset( &pacer_stats, 0, sizeof(pacer_stats) );
+	pacer_sum = 0;
+	pacer_sum_squares = 0;
+}
+
+const struct pacer_stats *pacer_get_stats( )
+{
+	double variance;
+
+	if ( pacer_stats.frames > 0 ) {
+		pacer_stats.mean = pacer_sum / pacer_stats.frames;
+		variance = pacer_sum_squares / pacer_stats.frames - pacer_stats.mean * pacer_stats.mean;
+		pacer_stats.jitter = variance > 0 ? SDL_sqrt( variance ) : 0;
+	}
+	return &pacer_stats;
+}
+
+static void pacer_record( Uint64 elapsed )
+{
+	double ms;
+	int bucket;
+
+	ms = elapsed * 1000.0 / pacer_frequency;
+	bucket = (int)( ms / PACER_BUCKET_WIDTH );
+	if ( bucket >= PACER_BUCKETS ) {
+		bucket = PACER_BUCKETS - 1;
+	}
+	pacer_stats.histogram[ bucket ]++;
+	pacer_stats.frames++;
+	if ( ms > pacer_stats.max ) {
+		pacer_stats.max = ms;
+	}
+	pacer_sum += ms;
+	pacer_sum_squares += ms * ms;
+}
+
+/* Advances the deadline by exactly one frame period. The remainder of
+ * frequency / fps is carried so the long-run cadence does not drift. */
+static Uint64 pacer_advance( )
+{
+	Uint64 period;
+
+	period = pacer_frequency / base_fps;
+	pacer_remainder += pacer_frequency % base_fps;
+	pacer_deadline += period + pacer_remainder / base_fps;
+	pacer_remainder %= base_fps;
+	return period;
+}
+
+/* Milliseconds until the end of the current frame period, or -1 when
+ * frames are not paced here. */
+double pacer_get_time_left( )
+{
+	Uint64 now, deadline;
+
+	if ( base_headless || (pacer_refresh_rate && base_fps >= pacer_refresh_rate) ) {
+		return -1;
+	}
+	now = SDL_GetPerformanceCounter( );
+	deadline = pacer_deadline + pacer_frequency / base_fps;
+	return now < deadline ? ( deadline - now ) * 1000.0 / pacer_frequency : 0;
+}
+
+/* Waits until the end of the current frame period. */
+void pacer_wait( )
+{
+	Uint64 now, period, spin;
+	Uint32 ms;
+
+	now = SDL_GetPerformanceCounter( );
+	if ( base_headless || (pacer_refresh_rate && base_fps >= pacer_refresh_rate) ) {
+		/* Headless runs are unpaced, and with vsync presenting has
+		 * already blocked until the vertical blank */
+		pacer_deadline = now;
+		pacer_remainder = 0;
+	} else {
+		period = pacer_advance( );
+		if ( now > pacer_deadline ) {
+			pacer_stats.late++;
+			if ( now - pacer_deadline > period ) {
+				/* Too far behind to catch up without a burst of frames */
+				pacer_deadline = now;
+				pacer_remainder = 0;
+			}
+		} else {
+			spin = pacer_frequency * PACER_SPIN_MICROSECONDS / 1000000;
+			while ( now + spin < pacer_deadline ) {
+				ms = (Uint32)( (pacer_deadline - now - spin) * 1000 / pacer_frequency );
+				if ( ms == 0 ) {
+					break;
+				}
+				SDL_Delay( ms );
+				now = SDL_GetPerformanceCounter( );
+			}
+			while ( now < pacer_deadline ) {
+				now = SDL_GetPerformanceCounter( );
+			}
+		}
+	}
+	pacer_record( now - pacer_last );
+	pacer_last = now;
+}
@@ -0,0 +1,377 @@
+#include "moonbase.h"
+
+/*
+ * A timer arms a count hook on the engine state and the game thread once
+ * per sampling interval; the hook fires on the next VM instruction, takes
+ * one sample and disarms itself again. Lua code therefore runs without a
+ * hook between samples, as a hook left installed costs every instruction.
+ * lua_sethook is safe to call asynchronously, which is how the standalone
+ * interpreter handles signals. Samples are kept as folded stacks, root
+ * first and separated by semicolons, the input format of flamegraph.pl
+ * and speedscope.
+ */
+#define PROFILER_DEFAULT_INTERVAL	1000	/* microseconds */
+#define PROFILER_MAX_DEPTH		64
+#define PROFILER_STACK_LENGTH		4096
+
+struct profiler_count {
+	unsigned long	samples;
+};
+
+static int		profiler_running;
+static char		*profiler_path;
+static struct mht	*profiler_stacks;
+static SDL_TimerID	profiler_timer;
+static unsigned long	profiler_samples;
+
+static void profiler_free_stack( void *k, void *v )
+{
+	SDL_free( k );
+	SDL_free( v );
+}
+
+/* Appends a frame name, replacing characters that the folded format
+ * uses as separators. */
+static size_t profiler_append( char *buf, size_t len, const char *s )
+{
+	for ( ; *s && len < PROFILER_STACK_LENGTH - 1; ++s ) {
+		buf[ len++ ] = ( *s == ';' || *s == '\n' ) ? ':' : *s;
+	}
+	buf[ len ] = 0;
+	return len;
+}
+
+static void profiler_sample( lua_State *s )
+{
+	lua_Debug frames[ PROFILER_MAX_DEPTH ];
+	struct profiler_count *count;
+	char buf[ PROFILER_STACK_LENGTH ];
+	char frame[ 256 ];
+	size_t len;
+	int depth, i;
+
+	for ( depth = 0; depth < PROFILER_MAX_DEPTH && lua_getstack(s, depth, &frames[depth]); ++depth ) {
+		lua_getinfo( s, "Sn", &frames[depth] );
+	}
+	if ( s == base_game_state ) {
+		len = profiler_append( buf, 0, "[game]" );
+	} else if ( s == base_engine_state ) {
+		len = profiler_append( buf, 0, "[engine]" );
+	} else {
+		len = profiler_append( buf, 0, "[coroutine]" );
+	}
+	for ( i = depth - 1; i >= 0; --i ) {
+		if ( frames[i].what[0] == 'C' ) {
+			SDL_snprintf( frame, sizeof(frame), "%s [C]", frames[i].name ? frames[i].name : "?" );
+		} else if ( frames[i].what[0] == 'm' ) {
+			SDL_snprintf( frame, sizeof(frame), "main chunk (%s)", frames[i].short_src );
+		} else {
+			SDL_snprintf( frame, sizeof(frame), "%s (%s:%d)", frames[i].name ? frames[i].name : "?",
+				frames[i].short_src, frames[i].linedefined );
+		}
+		/* The separator goes in directly; profiler_append would
+		 * replace it like one inside a name */
+		if ( len < PROFILER_STACK_LENGTH - 1 ) {
+			buf[ len++ ] = ';';
+			buf[ len ] = 0;
+		}
+		len = profiler_append( buf, len, frame );
+	}
+	if ( mht_get(profiler_stacks, buf, (void**)&count) != 0 ) {
+		count = (struct profiler_count*)SDL_calloc( 1, sizeof(struct profiler_count) );
+		if ( count == NULL ) {
+			fatal( "Failed to allocate profiler sample\n" );
+		}
+		mht_set( profiler_stacks, SDL_strdup(buf), count, 0 );
+	}
+	count->samples++;
+	profiler_samples++;
+}
+
+static void profiler_disarm( lua_State *s )
+{
+	lua_sethook( s, NULL, 0, 0 );
+	lua_sethook( base_engine_state, NULL, 0, 0 );
+	if ( base_game_state != NULL ) {
+		lua_sethook( base_game_state, NULL, 0, 0 );
+	}
+}
+
+/* Whichever armed state runs first takes the sample. A coroutine created
+ * while the hook was armed inherits it and may be the one. Time spent in
+ * a running coroutine is counted at its resume once it yields. */
+static void profiler_hook( lua_State *s, lua_Debug *ar )
+{
+	profiler_disarm( s );
+	if ( profiler_running ) {
+		profiler_sample( s );
+	}
+}
+
+/* Runs on SDL's timer thread */
+static Uint32 profiler_arm( Uint32 interval, void *param )
+{
+	lua_sethook( base_engine_state, profiler_hook, LUA_MASKCOUNT, 1 );
+	if ( base_game_state != NULL ) {
+		lua_sethook( base_game_state, profiler_hook, LUA_MASKCOUNT, 1 );
+	}
+	return interval;
+}
+
+/* interval is in microseconds, rounded up to SDL's millisecond timers;
+ * 0 picks the default */
+void profiler_start( const char *path, int interval )
+{
+	if ( profiler_running ) {
+		return;
+	}
+	if ( interval <= 0 ) {
+		interval = PROFILER_DEFAULT_INTERVAL;
+	}
+	profiler_path = SDL_strdup( path );
+	profiler_stacks = mht_strk_new( 256, profiler_free_stack );
+	profiler_samples = 0;
+	profiler_running = 1;
+	profiler_timer = SDL_AddTimer( (interval + 999) / 1000, profiler_arm, NULL );
+	if ( profiler_timer == 0 ) {
+		log_printf( LOG_ERROR, "Failed to start profiler timer: %s", SDL_GetError() );
+	}
+}
+
+int profiler_is_running( )
+{
+	return profiler_running;
+}
+
+/* Stops sampling and writes the folded stacks into the data path */
+void profiler_stop( )
+{
+	struct mht_ent *e;
+	FILE *f;
+	size_t i;
+
+	if ( !profiler_running ) {
+		return;
+	}
+	profiler_running = 0;
+	/* A tick already under way may arm the hook once more; it then
+	 * disarms itself without sampling */
+	SDL_RemoveTimer( profiler_timer );
+	profiler_disarm( base_engine_state );
+	f = storage_open( profiler_path, "w" );
+	if ( f == NULL ) {
+		log_printf( LOG_ERROR, "Failed to write profile %s", profiler_path );
+	} else {
+		for ( i = 0; i < mht_capacity(profiler_stacks); ++i ) {
+			for ( e = profiler_stacks->table[i]; e != NULL; e = e->next ) {
+				fprintf( f, "%s %lu\n", (const char*)e->k, ((struct profiler_count*)e->v)->samples );
+			}
+		}
+		fclose( f );
+		log_printf( LOG_INFO, "Wrote %lu profiler samples to %s", profiler_samples, profiler_path );
+	}
+	mht_free( profiler_stacks );
+	profiler_stacks = NULL;
+	SDL_free( profiler_path );
+	profiler_path = NULL;
+}
+
+/*
+ * The allocation profiler wraps the engine state's allocator. Every
+ * rate-th growing allocation is attributed to the source line of the
+ * nearest Lua function on the running state's stack; the report scales
+ * sampled totals back up by rate.
+ */
+#define PROFILER_DEFAULT_ALLOC_RATE	64
+
+struct profiler_site {
+	char		*location;
+	unsigned long	bytes, count;
+};
+
+static lua_Alloc	profiler_alloc_original;
+static void		*profiler_alloc_ud;
+static int		profiler_alloc_running;
+static int		profiler_alloc_rate;
+static int		profiler_alloc_countdown;
+static char		*profiler_alloc_path;
+static struct mht	*profiler_sites;
+static unsigned long	profiler_alloc_bytes, profiler_alloc_count;
+
+static void profiler_alloc_sample( size_t bytes )
+{
+	lua_State *s;
+	lua_Debug ar;
+	struct profiler_site *site;
+	char location[ 256 ];
+	const char *cname;
+	int level;
+
+	s = base_running_state;
+	cname = NULL;
+	for ( level = 0; lua_getstack(s, level, &ar); ++level ) {
+		lua_getinfo( s, "Sln", &ar );
+		if ( ar.what[0] != 'C' ) {
+			break;
+		}
+		if ( level == 0 ) {
+			cname = ar.name;
+		}
+	}
+	if ( !lua_getstack(s, level, &ar) ) {
+		SDL_strlcpy( location, "[no Lua code]", sizeof(location) );
+	} else if ( cname != NULL ) {
+		SDL_snprintf( location, sizeof(location), "%s:%d %s", ar.short_src, ar.currentline, cname );
+	} else {
+		SDL_snprintf( location, sizeof(location), "%s:%d", ar.short_src, ar.currentline );
+	}
+	if ( mht_get(profiler_sites, location, (void**)&site) != 0 ) {
+		site = (struct profiler_site*)SDL_calloc( 1, sizeof(struct profiler_site) );
+		if ( site == NULL ) {
+			fatal( "Failed to allocate profiler site\n" );
+		}
+		site->location = SDL_strdup( location );
+		mht_set( profiler_sites, site->location, site, 0 );
+	}
+	site->bytes += bytes;
+	site->count++;
+}
+
+static void *profiler_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+	size_t grown;
+
+	/* osize carries the object type, not a size, when ptr is NULL */
+	grown = nsize > (ptr ? osize : 0) ? nsize - (ptr ? osize : 0) : 0;
+	if ( grown > 0 && profiler_alloc_running ) {
+		profiler_alloc_bytes += grown;
+		profiler_alloc_count++;
+		if ( --profiler_alloc_countdown <= 0 ) {
+			profiler_alloc_countdown = profiler_alloc_rate;
+			profiler_alloc_sample( grown );
+		}
+	}
+	return profiler_alloc_original( profiler_alloc_ud, ptr, osize, nsize );
+}
+
+/* rate samples one in every rate allocations; 0 picks the default */
+void profiler_start_allocations( const char *path, int rate )
+{
+	if ( profiler_alloc_running ) {
+		return;
+	}
+	profiler_alloc_path = SDL_strdup( path );
+	profiler_alloc_rate = rate > 0 ? rate : PROFILER_DEFAULT_ALLOC_RATE;
+	profiler_alloc_countdown = profiler_alloc_rate;
+	profiler_alloc_bytes = 0;
+	profiler_alloc_count = 0;
+	/* sites are freed through their own entries, keys point into them */
+	profiler_sites = mht_strk_new( 256, NULL );
+	if ( profiler_alloc_original == NULL ) {
+		profiler_alloc_original = lua_getallocf( base_engine_state, &profiler_alloc_ud );
+		lua_setallocf( base_engine_state, profiler_alloc, NULL );
+	}
+	profiler_alloc_running = 1;
+}
+
+static int profiler_compare_sites( const void *a, const void *b )
+{
+	const struct profiler_site *p, *q;
+
+	p = *(const struct profiler_site**)a;
+	q = *(const struct profiler_site**)b;
+	return ( p->bytes > q->bytes ) ? -1 : ( p->bytes < q->bytes );
+}
+
+/* Stops attributing allocations and writes the sites, heaviest first,
+ * into the data path. The wrapper stays installed since blocks already
+ * handed out go back through it. */
+void profiler_stop_allocations( )
+{
+	struct profiler_site **sites;
+	struct mht_ent *e;
+	FILE *f;
+	size_t i, n;
+
+	if ( !profiler_alloc_running ) {
+		return;
+	}
+	profiler_alloc_running = 0;
+	sites = (struct profiler_site**)SDL_malloc( (mht_size(profiler_sites) + 1) * sizeof(struct profiler_site*) );
+	if ( sites == NULL ) {
+		fatal( "Failed to allocate profiler report\n" );
+	}
+	for ( n = 0, i = 0; i < mht_capacity(profiler_sites); ++i ) {
+		for ( e = profiler_sites->table[i]; e != NULL; e = e->next ) {
+			sites[ n++ ] = (struct profiler_site*)e->v;
+		}
+	}
+	SDL_qsort( sites, n, sizeof(struct profiler_site*), profiler_compare_sites );
+	f = storage_open( profiler_alloc_path, "w" );
+	if ( f == NULL ) {
+		log_printf( LOG_ERROR, "Failed to write allocation profile %s", profiler_alloc_path );
+	} else {
+		fprintf( f, "# %lu allocations, %lu bytes; sites sampled 1 in %d and scaled\n",
+			profiler_alloc_count, profiler_alloc_bytes, profiler_alloc_rate );
+		fprintf( f, "# bytes\tcount\tlocation\n" );
+		for ( i = 0; i < n; ++i ) {
+			fprintf( f, "%lu\t%lu\t%s\n", sites[i]->bytes * profiler_alloc_rate,
+				sites[i]->count * profiler_alloc_rate, sites[i]->location );
+		}
+		fclose( f );
+	}
+	for ( i = 0; i < n; ++i ) {
+		SDL_free( sites[i]->location );
+		SDL_free( sites[i] );
+	}
+	SDL_free( sites );
+	mht_free( profiler_sites );
+	profiler_sites = NULL;
+	SDL_free( profiler_alloc_path );
+	profiler_alloc_path = NULL;
+}
+
+static int moonbase_profiler_start( lua_State *s )
+{
+	profiler_start( luaL_optstring(s, 1, "profile.folded"), luaL_optint(s, 2, 0) );
+	return 0;
+}
+
+static int moonbase_profiler_stop( lua_State *s )
+{
+	profiler_stop( );
+	return 0;
+}
+
+static int moonbase_profiler_start_allocations( lua_State *s )
+{
+	profiler_start_allocations( luaL_optstring(s, 1, "allocations.txt"), luaL_optint(s, 2, 0) );
+	return 0;
+}
+
+static int moonbase_profiler_stop_allocations( lua_State *s )
+{
+	profiler_stop_allocations( );
+	return 0;
+}
+
+static int moonbase_profiler_is_running( lua_State *s )
+{
+	lua_pushboolean( s, profiler_running );
+	return 1;
+}
+
+static luaL_Reg moonbase_profiler_methods[] = {
+	{ "start", moonbase_profiler_start },
+	{ "stop", moonbase_profiler_stop },
+	{ "isRunning", moonbase_profiler_is_running },
+	{ "startAllocations", moonbase_profiler_start_allocations },
+	{ "stopAllocations", moonbase_profiler_stop_allocations },
+	{ NULL, NULL }
+};
+
+int moonbase_profiler_initialize( lua_State *s )
+{
+	luaL_newlib( s, moonbase_profiler_methods );
+	return 1;
+}
@@ -0,0 +1,901 @@
+#include "moonbase.h"
+
+#define RENDER_MAX_DEPTH	16
+
+static struct render_buffer	render_frame;
+static struct render_buffer	*render_stack[ RENDER_MAX_DEPTH ];
+static struct render_buffer	render_targets[ RENDER_MAX_DEPTH ];
+static int			render_depth;
+
+static int			*render_indices;
+static int			render_max_sprites;
+
+static SDL_Texture		**render_graveyard;
+static int			render_num_graveyard, render_max_graveyard;
+
+static const struct render_command	**render_order;
+static int				render_max_order;
+static SDL_Vertex			*render_scratch;
+static int				render_max_scratch;
+
+static SDL_Color		render_draw_color;
+static int			render_layer, render_layer_order;
+static struct render_stats	render_stats;
+
+#define render_current( )	(render_stack[render_depth])
+
+void render_initialize( )
+{
+	memset( &render_frame, 0, sizeof(render_frame) );
+	memset( render_targets, 0, sizeof(render_targets) );
+	render_stack[0] = &render_frame;
+	render_depth = 0;
+	render_indices = NULL;
+	render_max_sprites = 0;
+	render_graveyard = NULL;
+	render_num_graveyard = 0;
+	render_max_graveyard = 0;
+	render_draw_color.r = 0;
+	render_draw_color.g = 0;
+	render_draw_color.b = 0;
+	render_draw_color.a = 255;
+	render_layer = 0;
+	render_layer_order = RENDER_ORDER_PAINTER;
+	render_order = NULL;
+	render_max_order = 0;
+	render_scratch = NULL;
+	render_max_scratch = 0;
+	memset( &render_stats, 0, sizeof(render_stats) );
+}
+
+void render_shutdown( )
+{
+	int i;
+
+	render_reset( );
+	for ( i = 0; i < RENDER_MAX_DEPTH; ++i ) {
+		render_buffer_release( &render_targets[i] );
+	}
+	render_buffer_release( &render_frame );
+	SDL_free( render_indices );
+	SDL_free( render_graveyard );
+	SDL_free( render_order );
+	SDL_free( render_scratch );
+	render_indices = NULL;
+	render_max_sprites = 0;
+	render_graveyard = NULL;
+	render_max_graveyard = 0;
+	render_order = NULL;
+	render_max_order = 0;
+	render_scratch = NULL;
+	render_max_scratch = 0;
+}
+
+void render_reset( )
+{
+	int i;
+
+	render_buffer_clear( &render_frame );
+	for ( i = 0; i < RENDER_MAX_DEPTH; ++i ) {
+		render_buffer_clear( &render_targets[i] );
+		render_targets[i].target = NULL;
+	}
+	render_depth = 0;
+	for ( i = 0; i < render_num_graveyard; ++i ) {
+		SDL_DestroyTexture( render_graveyard[i] );
+	}
+	render_num_graveyard = 0;
+}
+
+void render_set_draw_color( const SDL_Color *color )
+{
+	render_draw_color = *color;
+}
+
+void render_set_layer( int layer, int order )
+{
+	render_layer = layer;
+	render_layer_order = order;
+}
+
+int render_get_layer( )
+{
+	return render_layer;
+}
+
+/* Textures still referenced by queued commands are destroyed once the
+ * frame has been submitted. Scratch target buffers do not hold
+ * references to the images drawn into them, so any open target also
+ * defers destruction. */
+void render_destroy_texture( SDL_Texture *texture )
+{
+	if ( render_frame.num_commands == 0 && render_depth == 0 ) {
+		SDL_DestroyTexture( texture );
+		return;
+	}
+	if ( render_num_graveyard == render_max_graveyard ) {
+		render_max_graveyard = render_max_graveyard ? render_max_graveyard * 2 : 16;
+		render_graveyard = (SDL_Texture**)SDL_realloc( render_graveyard, render_max_graveyard * sizeof(SDL_Texture*) );
+		if ( render_graveyard == NULL ) {
+			fatal( "Failed to allocate texture graveyard\n" );
+		}
+	}
+	render_graveyard[ render_num_graveyard++ ] = texture;
+}
+
+static struct render_command *render_push( struct render_buffer *b, int type )
+{
+	struct render_command *cmd;
+
+	if ( b->num_commands == b->max_commands ) {
+		b->max_commands = b->max_commands ? b->max_commands * 2 : 256;
+		b->commands = (struct render_command*)SDL_realloc( b->commands, b->max_commands * sizeof(struct render_command) );
+		if ( b->commands == NULL ) {
+			fatal( "Failed to allocate %d render commands\n", b->max_commands );
+		}
+	}
+	cmd = &b->commands[ b->num_commands++ ];
+	cmd->type = type;
+	cmd->color = render_draw_color;
+	cmd->texture = NULL;
+	cmd->image = NULL;
+	cmd->first = 0;
+	cmd->count = 0;
+	cmd->layer = render_layer;
+	cmd->order = render_layer_order;
+	cmd->blend = SDL_BLENDMODE_NONE;
+	cmd->alpha = 255;
+	return cmd;
+}
+
+static SDL_Vertex *render_reserve_vertices( struct render_buffer *b, int count )
+{
+	if ( b->num_vertices + count > b->max_vertices ) {
+		if ( b->max_vertices == 0 ) {
+			b->max_vertices = 1024;
+		}
+		while ( b->num_vertices + count > b->max_vertices ) {
+			b->max_vertices *= 2;
+		}
+		b->vertices = (SDL_Vertex*)SDL_realloc( b->vertices, b->max_vertices * sizeof(SDL_Vertex) );
+		if ( b->vertices == NULL ) {
+			fatal( "Failed to allocate %d vertices\n", b->max_vertices );
+		}
+	}
+	return b->vertices + b->num_vertices;
+}
+
+static SDL_Point *render_reserve_points( struct render_buffer *b, int count )
+{
+	if ( b->num_points + count > b->max_points ) {
+		if ( b->max_points == 0 ) {
+			b->max_points = 256;
+		}
+		while ( b->num_points + count > b->max_points ) {
+			b->max_points *= 2;
+		}
+		b->points = (SDL_Point*)SDL_realloc( b->points, b->max_points * sizeof(SDL_Point) );
+		if ( b->points == NULL ) {
+			fatal( "Failed to allocate %d points\n", b->max_points );
+		}
+	}
+	return b->points + b->num_points;
+}
+
+static SDL_Rect *render_reserve_rects( struct render_buffer *b, int count )
+{
+	if ( b->num_rects + count > b->max_rects ) {
+		if ( b->max_rects == 0 ) {
+			b->max_rects = 256;
+		}
+		while ( b->num_rects + count > b->max_rects ) {
+			b->max_rects *= 2;
+		}
+		b->rects = (SDL_Rect*)SDL_realloc( b->rects, b->max_rects * sizeof(SDL_Rect) );
+		if ( b->rects == NULL ) {
+			fatal( "Failed to allocate %d rectangles\n", b->max_rects );
+		}
+	}
+	return b->rects + b->num_rects;
+}
+
+static void render_reserve_indices( int sprites )
+{
+	int i, capacity;
+
+	if ( sprites <= render_max_sprites ) {
+		return;
+	}
+	for ( capacity = 64; capacity < sprites; capacity *= 2 );
+	render_indices = (int*)SDL_realloc( render_indices, capacity * 6 * sizeof(int) );
+	if ( render_indices == NULL ) {
+		fatal( "Failed to allocate indices for %d sprites\n", capacity );
+	}
+	for ( i = render_max_sprites; i < capacity; ++i ) {
+		render_indices[ i*6 + 0 ] = i*4 + 0;
+		render_indices[ i*6 + 1 ] = i*4 + 1;
+		render_indices[ i*6 + 2 ] = i*4 + 2;
+		render_indices[ i*6 + 3 ] = i*4 + 0;
+		render_indices[ i*6 + 4 ] = i*4 + 2;
+		render_indices[ i*6 + 5 ] = i*4 + 3;
+	}
+	render_max_sprites = capacity;
+}
+
+static void render_build_vertices( SDL_Texture *texture, const struct sprite *sprites, int count, SDL_Vertex *v )
+{
+	static const float corners[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+	const struct sprite *sp;
+	struct rectangle src, dst;
+	SDL_Color color;
+	Uint8 r, g, b, alpha;
+	int i, j, w, h;
+	float c, sn, lx, ly, cx, cy;
+
+	SDL_QueryTexture( texture, NULL, NULL, &w, &h );
+	SDL_GetTextureColorMod( texture, &r, &g, &b );
+	SDL_GetTextureAlphaMod( texture, &alpha );
+	for ( i = 0, sp = sprites; i < count; ++i, ++sp ) {
+		src = sp->source;
+		if ( src.w == 0 && src.h == 0 ) {
+			src.w = w;
+			src.h = h;
+		}
+		dst = sp->destination;
+		if ( dst.w == 0 && dst.h == 0 ) {
+			dst.w = src.w;
+			dst.h = src.h;
+		}
+		color.r = ( (sp->tint >> 24) * r ) / 255;
+		color.g = ( ((sp->tint >> 16) & 0xff) * g ) / 255;
+		color.b = ( ((sp->tint >> 8) & 0xff) * b ) / 255;
+		color.a = ( (sp->tint & 0xff) * alpha ) / 255;
+		if ( sp->angle != 0 ) {
+			c = SDL_cos( sp->angle * M_PI / 180.0 );
+			sn = SDL_sin( sp->angle * M_PI / 180.0 );
+		} else {
+			c = 1;
+			sn = 0;
+		}
+		cx = dst.x + dst.w * 0.5f;
+		cy = dst.y + dst.h * 0.5f;
+		for ( j = 0; j < 4; ++j, ++v ) {
+			lx = ( corners[j][0] - 0.5f ) * dst.w;
+			ly = ( corners[j][1] - 0.5f ) * dst.h;
+			v->position.x = cx + lx * c - ly * sn;
+			v->position.y = cy + lx * sn + ly * c;
+			v->color = color;
+			v->tex_coord.x = ( src.x + corners[j][0] * src.w ) / w;
+			v->tex_coord.y = ( src.y + corners[j][1] * src.h ) / h;
+		}
+	}
+}
+
+void render_sprites( void *image, const struct sprite *sprites, int count )
+{
+	struct render_buffer *b;
+	struct render_command *cmd;
+	SDL_Texture *texture;
+	SDL_Vertex *v;
+	SDL_BlendMode blend;
+	Uint8 alpha;
+
+	if ( count <= 0 ) {
+		return;
+	}
+	b = render_current( );
+	texture = asset_image_handle( image );
+	SDL_GetTextureBlendMode( texture, &blend );
+	SDL_GetTextureAlphaMod( texture, &alpha );
+	cmd = b->num_commands ? &b->commands[ b->num_commands - 1 ] : NULL;
+	if ( cmd == NULL || cmd->type != RENDER_SPRITES || cmd->texture != texture ||
+	     cmd->layer != render_layer || cmd->order != render_layer_order ||
+	     cmd->blend != blend || cmd->alpha != alpha ) {
+		cmd = render_push( b, RENDER_SPRITES );
+		cmd->texture = texture;
+		cmd->image = b->retained ? asset_acquire( image ) : image;
+		cmd->first = b->num_vertices / 4;
+		cmd->blend = blend;
+		cmd->alpha = alpha;
+	}
+	v = render_reserve_vertices( b, count * 4 );
+	render_build_vertices( texture, sprites, count, v );
+	b->num_vertices += count * 4;
+	cmd->count += count;
+}
+
+void render_copy( void *image, const struct rectangle *source, const struct rectangle *destination )
+{
+	struct sprite sp;
+
+	sp.destination = *destination;
+	if ( source != NULL ) {
+		sp.source = *source;
+	} else {
+		memset( &sp.source, 0, sizeof(sp.source) );
+	}
+	sp.tint = 0xffffffff;
+	sp.angle = 0;
+	render_sprites( image, &sp, 1 );
+}
+
+void render_background( void *image )
+{
+	struct render_buffer *b;
+	struct render_command *cmd;
+
+	b = render_current( );
+	cmd = render_push( b, RENDER_BACKGROUND );
+	cmd->texture = asset_image_handle( image );
+	cmd->image = b->retained ? asset_acquire( image ) : image;
+	SDL_GetTextureBlendMode( cmd->texture, &cmd->blend );
+	SDL_GetTextureAlphaMod( cmd->texture, &cmd->alpha );
+}
+
+void render_clear( )
+{
+	render_push( render_current(), RENDER_CLEAR );
+}
+
+void render_line( const struct point *p, const struct point *q )
+{
+	struct render_command *cmd;
+
+	cmd = render_push( render_current(), RENDER_LINE );
+	cmd->rect.x = p->x;
+	cmd->rect.y = p->y;
+	cmd->rect.w = q->x;
+	cmd->rect.h = q->y;
+}
+
+void render_rect( const struct rectangle *r )
+{
+	render_push( render_current(), RENDER_RECT )->rect = *r;
+}
+
+void render_fill_rect( const struct rectangle *r )
+{
+	render_push( render_current(), RENDER_FILL_RECT )->rect = *r;
+}
+
+SDL_Point *render_reserve_points_batch( int count )
+{
+	return render_reserve_points( render_current(), count );
+}
+
+SDL_Rect *render_reserve_rects_batch( int count )
+{
+	return render_reserve_rects( render_current(), count );
+}
+
+void render_push_points( int type, int count )
+{
+	struct render_buffer *b;
+	struct render_command *cmd;
+
+	b = render_current( );
+	render_reserve_points( b, count );
+	cmd = render_push( b, type );
+	cmd->first = b->num_points;
+	cmd->count = count;
+	b->num_points += count;
+}
+
+void render_push_rects( int type, int count )
+{
+	struct render_buffer *b;
+	struct render_command *cmd;
+
+	b = render_current( );
+	render_reserve_rects( b, count );
+	cmd = render_push( b, type );
+	cmd->first = b->num_rects;
+	cmd->count = count;
+	b->num_rects += count;
+}
+
+int render_replay( struct render_buffer *buffer )
+{
+	struct render_buffer *b;
+	struct render_command *cmd;
+	int i, sprites, points, rects;
+
+	b = render_current( );
+	if ( b == buffer ) {
+		return -1;
+	}
+	sprites = b->num_vertices / 4;
+	points = b->num_points;
+	rects = b->num_rects;
+	if ( buffer->num_vertices > 0 ) {
+		render_reserve_vertices( b, buffer->num_vertices );
+		memcpy( b->vertices + b->num_vertices, buffer->vertices, buffer->num_vertices * sizeof(SDL_Vertex) );
+		b->num_vertices += buffer->num_vertices;
+	}
+	if ( buffer->num_points > 0 ) {
+		render_reserve_points( b, buffer->num_points );
+		memcpy( b->points + b->num_points, buffer->points, buffer->num_points * sizeof(SDL_Point) );
+		b->num_points += buffer->num_points;
+	}
+	if ( buffer->num_rects > 0 ) {
+		render_reserve_rects( b, buffer->num_rects );
+		memcpy( b->rects + b->num_rects, buffer->rects, buffer->num_rects * sizeof(SDL_Rect) );
+		b->num_rects += buffer->num_rects;
+	}
+	for ( i = 0; i < buffer->num_commands; ++i ) {
+		cmd = render_push( b, RENDER_CLEAR );
+		*cmd = buffer->commands[i];
+		switch ( cmd->type ) {
+		case RENDER_SPRITES:
+			cmd->first += sprites;
+			break;
+		case RENDER_LINES:
+		case RENDER_POINTS:
+			cmd->first += points;
+			break;
+		case RENDER_RECTS:
+		case RENDER_FILL_RECTS:
+			cmd->first += rects;
+			break;
+		}
+		if ( b->retained && cmd->image != NULL ) {
+			asset_acquire( cmd->image );
+		}
+	}
+	return 0;
+}
+
+static int render_compare( const void *a, const void *b )
+{
+	const struct render_command *p, *q;
+
+	p = *(const struct render_command**)a;
+	q = *(const struct render_command**)b;
+	if ( p->layer != q->layer ) {
+		return ( p->layer < q->layer ) ? -1 : 1;
+	}
+	if ( p->order != q->order ) {
+		return ( p->order < q->order ) ? -1 : 1;
+	}
+	if ( p->order == RENDER_ORDER_TEXTURE ) {
+		if ( p->texture != q->texture ) {
+			return ( (uintptr_t)p->texture < (uintptr_t)q->texture ) ? -1 : 1;
+		}
+		if ( p->blend != q->blend ) {
+			return ( p->blend < q->blend ) ? -1 : 1;
+		}
+		if ( p->alpha != q->alpha ) {
+			return ( p->alpha < q->alpha ) ? -1 : 1;
+		}
+	}
+	/* Recording order breaks ties, which keeps the sort stable; a
+	 * command is only equal to itself */
+	if ( p == q ) {
+		return 0;
+	}
+	return ( p < q ) ? -1 : 1;
+}
+
+/* Builds the submission order of a buffer's commands: stable by layer,
+ * then by texture, blend mode and alpha for layers that allow it.
+ * Clears are barriers that nothing is moved across. */
+static const struct render_command **render_sort( const struct render_buffer *b )
+{
+	int i, start, sort;
+
+	if ( b->num_commands > render_max_order ) {
+		render_max_order = b->max_commands;
+		render_order = (const struct render_command**)SDL_realloc( render_order, render_max_order * sizeof(struct render_command*) );
+		if ( render_order == NULL ) {
+			fatal( "Failed to allocate render order\n" );
+		}
+	}
+	sort = 0;
+	for ( i = 0; i < b->num_commands; ++i ) {
+		render_order[i] = &b->commands[i];
+		if ( b->commands[i].layer != b->commands[0].layer || b->commands[i].order != RENDER_ORDER_PAINTER ) {
+			sort = 1;
+		}
+	}
+	if ( !sort ) {
+		return render_order;
+	}
+	for ( start = 0, i = 0; i <= b->num_commands; ++i ) {
+		if ( i == b->num_commands || b->commands[i].type == RENDER_CLEAR ) {
+			if ( i - start > 1 ) {
+				SDL_qsort( render_order + start, i - start, sizeof(struct render_command*), render_compare );
+			}
+			start = i + 1;
+		}
+	}
+	return render_order;
+}
+
+/* Counts texture and blend mode switches the renderer sees when the
+ * commands are issued in the given order. */
+static int render_count_state_changes( const struct render_command **order, const struct render_command *commands, int n )
+{
+	const struct render_command *cmd;
+	SDL_Texture *texture;
+	SDL_BlendMode blend;
+	int i, changes;
+
+	texture = NULL;
+	blend = SDL_BLENDMODE_INVALID;
+	changes = 0;
+	for ( i = 0; i < n; ++i ) {
+		cmd = order ? order[i] : &commands[i];
+		if ( cmd->type != RENDER_SPRITES && cmd->type != RENDER_BACKGROUND ) {
+			continue;
+		}
+		if ( cmd->texture != texture ) {
+			texture = cmd->texture;
+			++changes;
+		}
+		if ( cmd->blend != blend ) {
+			blend = cmd->blend;
+			++changes;
+		}
+	}
+	return changes;
+}
+
+static void render_apply_draw_color( const SDL_Color *color, SDL_Color *current )
+{
+	if ( color->r == current->r && color->g == current->g &&
+	     color->b == current->b && color->a == current->a ) {
+		return;
+	}
+	*current = *color;
+	SDL_SetRenderDrawColor( video_renderer, color->r, color->g, color->b, color->a );
+}
+
+/* Draws a run of sprite commands sharing one texture with a single
+ * SDL_RenderGeometry call, gathering their vertices if sorting has
+ * separated them. */
+static void render_execute_sprites( const struct render_buffer *b, const struct render_command **run, int n )
+{
+	const SDL_Vertex *vertices;
+	int i, sprites, contiguous;
+
+	sprites = run[0]->count;
+	contiguous = 1;
+	for ( i = 1; i < n; ++i ) {
+		if ( run[i]->first != run[i-1]->first + run[i-1]->count ) {
+			contiguous = 0;
+		}
+		sprites += run[i]->count;
+	}
+	render_reserve_indices( sprites );
+	if ( contiguous ) {
+		vertices = b->vertices + run[0]->first * 4;
+	} else {
+		if ( sprites * 4 > render_max_scratch ) {
+			for ( render_max_scratch = 1024; render_max_scratch < sprites * 4; render_max_scratch *= 2 );
+			render_scratch = (SDL_Vertex*)SDL_realloc( render_scratch, render_max_scratch * sizeof(SDL_Vertex) );
+			if ( render_scratch == NULL ) {
+				fatal( "Failed to allocate %d vertices\n", render_max_scratch );
+			}
+		}
+		for ( i = 0, sprites = 0; i < n; ++i ) {
+			memcpy( render_scratch + sprites * 4, b->vertices + run[i]->first * 4, run[i]->count * 4 * sizeof(SDL_Vertex) );
+			sprites += run[i]->count;
+		}
+		vertices = render_scratch;
+	}
+	SDL_RenderGeometry( video_renderer, run[0]->texture, vertices, sprites * 4, render_indices, sprites * 6 );
+}
+
+/* Issues a buffer's commands to the SDL renderer; returns the number of
+ * renderer calls made. */
+static int render_execute( const struct render_buffer *b, const struct render_command **order )
+{
+	const struct render_command *cmd;
+	SDL_Color current;
+	Uint8 alpha;
+	int i, j, calls;
+
+	SDL_GetRenderDrawColor( video_renderer, &current.r, &current.g, &current.b, &current.a );
+	calls = 0;
+	for ( i = 0; i < b->num_commands; i = j, ++calls ) {
+		cmd = order[i];
+		j = i + 1;
+		switch ( cmd->type ) {
+		case RENDER_CLEAR:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderClear( video_renderer );
+			break;
+		case RENDER_SPRITES:
+			while ( j < b->num_commands && order[j]->type == RENDER_SPRITES &&
+			        order[j]->texture == cmd->texture && order[j]->blend == cmd->blend ) {
+				++j;
+			}
+			render_execute_sprites( b, order + i, j - i );
+			break;
+		case RENDER_BACKGROUND:
+			SDL_GetTextureAlphaMod( cmd->texture, &alpha );
+			SDL_SetTextureAlphaMod( cmd->texture, cmd->alpha );
+			SDL_RenderCopy( video_renderer, cmd->texture, NULL, NULL );
+			SDL_SetTextureAlphaMod( cmd->texture, alpha );
+			break;
+		case RENDER_LINE:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderDrawLine( video_renderer, cmd->rect.x, cmd->rect.y, cmd->rect.w, cmd->rect.h );
+			break;
+		case RENDER_RECT:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderDrawRect( video_renderer, (const SDL_Rect*)&cmd->rect );
+			break;
+		case RENDER_FILL_RECT:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderFillRect( video_renderer, (const SDL_Rect*)&cmd->rect );
+			break;
+		case RENDER_LINES:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderDrawLines( video_renderer, b->points + cmd->first, cmd->count );
+			break;
+		case RENDER_POINTS:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderDrawPoints( video_renderer, b->points + cmd->first, cmd->count );
+			break;
+		case RENDER_RECTS:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderDrawRects( video_renderer, b->rects + cmd->first, cmd->count );
+			break;
+		case RENDER_FILL_RECTS:
+			render_apply_draw_color( &cmd->color, &current );
+			SDL_RenderFillRects( video_renderer, b->rects + cmd->first, cmd->count );
+			break;
+		}
+	}
+	return calls;
+}
+
+/* A script error or early return between begin and finish leaves buffers
+ * on the stack, and everything drawn after would go into them. They are
+ * dropped here so the next frame draws to the screen again. */
+static void render_unwind( )
+{
+	int i;
+
+	log_printf( LOG_WARN, "%d render target%s still open at end of frame", render_depth,
+		render_depth == 1 ? " was" : "s were" );
+	for ( i = 1; i < RENDER_MAX_DEPTH; ++i ) {
+		render_buffer_clear( &render_targets[i] );
+		render_targets[i].target = NULL;
+	}
+	render_depth = 0;
+}
+
+void render_submit( )
+{
+	const struct render_command **order;
+	int i, sprites;
+
+	if ( render_depth != 0 ) {
+		render_unwind( );
+	}
+	sprites = 0;
+	for ( i = 0; i < render_frame.num_commands; ++i ) {
+		if ( render_frame.commands[i].type == RENDER_SPRITES ) {
+			sprites += render_frame.commands[i].count;
+		}
+	}
+	order = render_sort( &render_frame );
+	render_stats.commands = render_frame.num_commands;
+	render_stats.sprites = sprites;
+	render_stats.unsorted_state_changes = render_count_state_changes( NULL, render_frame.commands, render_frame.num_commands );
+	render_stats.state_changes = render_count_state_changes( order, NULL, render_frame.num_commands );
+	render_stats.draw_calls = render_execute( &render_frame, order );
+	render_buffer_clear( &render_frame );
+	for ( i = 0; i < render_num_graveyard; ++i ) {
+		SDL_DestroyTexture( render_graveyard[i] );
+	}
+	render_num_graveyard = 0;
+}
+
+/* Draws a buffer into a target texture right away, optionally clearing
+ * it to transparent first. The frame buffer is unaffected. */
+void render_to_texture( const struct render_buffer *b, SDL_Texture *target, int clear )
+{
+	SDL_Texture *previous;
+	Uint8 r, g, bl, a;
+
+	previous = SDL_GetRenderTarget( video_renderer );
+	SDL_SetRenderTarget( video_renderer, target );
+	if ( clear ) {
+		SDL_GetRenderDrawColor( video_renderer, &r, &g, &bl, &a );
+		SDL_SetRenderDrawColor( video_renderer, 0, 0, 0, 0 );
+		SDL_RenderClear( video_renderer );
+		SDL_SetRenderDrawColor( video_renderer, r, g, bl, a );
+	}
+	render_execute( b, render_sort(b) );
+	SDL_SetRenderTarget( video_renderer, previous );
+}
+
+const struct render_stats *render_get_stats( )
+{
+	return &render_stats;
+}
+
+struct render_buffer *render_buffer_new( int retained )
+{
+	struct render_buffer *b;
+
+	b = (struct render_buffer*)SDL_calloc( 1, sizeof(struct render_buffer) );
+	if ( b == NULL ) {
+		fatal( "Failed to allocate command buffer\n" );
+	}
+	b->retained = retained;
+	return b;
+}
+
+void render_buffer_clear( struct render_buffer *b )
+{
+	int i;
+
+	for ( i = 0; b->retained && i < b->num_commands; ++i ) {
+		if ( b->commands[i].image != NULL ) {
+			asset_release( b->commands[i].image );
+		}
+	}
+	b->num_commands = 0;
+	b->num_vertices = 0;
+	b->num_points = 0;
+	b->num_rects = 0;
+}
+
+/* Frees the storage of a buffer without freeing the buffer itself, for
+ * buffers that are not allocated with render_buffer_new. */
+void render_buffer_release( struct render_buffer *b )
+{
+	render_buffer_clear( b );
+	SDL_free( b->commands );
+	SDL_free( b->vertices );
+	SDL_free( b->points );
+	SDL_free( b->rects );
+	memset( b, 0, sizeof(*b) );
+}
+
+void render_buffer_free( struct render_buffer *b )
+{
+	int i;
+
+	for ( i = 1; i <= render_depth; ++i ) {
+		if ( render_stack[i] == b ) {
+			render_depth = i - 1;
+			break;
+		}
+	}
+	render_buffer_release( b );
+	SDL_free( b );
+}
+
+int render_begin( struct render_buffer *b )
+{
+	if ( render_depth + 1 == RENDER_MAX_DEPTH ) {
+		return -1;
+	}
+	render_stack[ ++render_depth ] = b;
+	return 0;
+}
+
+int render_end( struct render_buffer *b )
+{
+	if ( render_depth == 0 || render_current() != b ) {
+		return -1;
+	}
+	--render_depth;
+	return 0;
+}
+
+/* Redirects drawing into a render target texture until the matching
+ * render_end_target, which draws the recorded commands into it,
+ * optionally clearing it to transparent first. */
+int render_begin_target( SDL_Texture *target )
+{
+	struct render_buffer *b;
+
+	if ( render_depth + 1 == RENDER_MAX_DEPTH ) {
+		return -1;
+	}
+	b = &render_targets[ render_depth + 1 ];
+	b->target = target;
+	return render_begin( b );
+}
+
+int render_end_target( SDL_Texture *target, int clear )
+{
+	struct render_buffer *b;
+
+	b = render_current( );
+	if ( render_depth == 0 || b->target != target ) {
+		return -1;
+	}
+	render_end( b );
+	render_to_texture( b, target, clear );
+	render_buffer_clear( b );
+	b->target = NULL;
+	return 0;
+}
+
+static int moonbase_command_buffer_begin( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = *(struct render_buffer**)luacom_check_object( s, 1, &moonbase_command_buffer_class );
+	if ( render_begin(b) ) {
+		return luaL_error( s, "command buffers nested too deeply" );
+	}
+	return 0;
+}
+
+static int moonbase_command_buffer_finish( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = *(struct render_buffer**)luacom_check_object( s, 1, &moonbase_command_buffer_class );
+	if ( render_end(b) ) {
+		return luaL_error( s, "command buffer is not recording" );
+	}
+	return 0;
+}
+
+static int moonbase_command_buffer_clear( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = *(struct render_buffer**)luacom_check_object( s, 1, &moonbase_command_buffer_class );
+	render_buffer_clear( b );
+	return 0;
+}
+
+static int moonbase_command_buffer_submit( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = *(struct render_buffer**)luacom_check_object( s, 1, &moonbase_command_buffer_class );
+	if ( render_replay(b) ) {
+		return luaL_error( s, "command buffer cannot be submitted into itself" );
+	}
+	return 0;
+}
+
+static int moonbase_command_buffer_get_size( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = *(struct render_buffer**)luacom_check_object( s, 1, &moonbase_command_buffer_class );
+	lua_pushinteger( s, b->num_commands );
+	return 1;
+}
+
+static int moonbase_command_buffer_gc( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = *(struct render_buffer**)luacom_check_object( s, 1, &moonbase_command_buffer_class );
+	render_buffer_free( b );
+	return 0;
+}
+
+luaL_Reg moonbase_command_buffer_methods[] = {
+	{ "begin", moonbase_command_buffer_begin },
+	{ "finish", moonbase_command_buffer_finish },
+	{ "clear", moonbase_command_buffer_clear },
+	{ "submit", moonbase_command_buffer_submit },
+	{ "getSize", moonbase_command_buffer_get_size },
+	{ "__gc", moonbase_command_buffer_gc },
+	{ NULL, NULL }
+};
+
+struct luacom_class moonbase_command_buffer_class = { "moonbase_command_buffer", moonbase_command_buffer_methods };
+
+int moonbase_video_command_buffer( lua_State *s )
+{
+	struct render_buffer *b;
+
+	b = render_buffer_new( 1 );
+	luacom_create_object( s, &moonbase_command_buffer_class, &b, sizeof(b) );
+	return 1;
+}
@@ -0,0 +1,192 @@
+#include "moonbase.h"
+
+/*
+ * Input recordings start with a header of REPLAY_MAGIC, the format
+ * version and the frame rate, followed by one record per event: the
+ * frame number, the event type and the fields game_input reads for that
+ * type, all little endian. A record of type REPLAY_END marks the frame
+ * the recording stopped on.
+ */
+#define REPLAY_MAGIC	0x5249424d	/* "MBIR" */
+#define REPLAY_VERSION	1
+#define REPLAY_END	0
+
+static SDL_RWops	*replay_file;
+static int		replay_mode;
+static int		replay_pending;
+static Uint32		replay_frame;
+static SDL_Event	replay_event;
+
+static void replay_write_text( const char *text )
+{
+	Uint8 n;
+
+	n = (Uint8)SDL_strlen( text );
+	SDL_WriteU8( replay_file, n );
+	SDL_RWwrite( replay_file, text, 1, n );
+}
+
+static int replay_read_text( char *text, size_t size )
+{
+	Uint8 n;
+
+	n = SDL_ReadU8( replay_file );
+	if ( n >= size || SDL_RWread(replay_file, text, 1, n) != n ) {
+		return -1;
+	}
+	text[n] = 0;
+	return 0;
+}
+
+void replay_start_recording( const char *path )
+{
+	replay_file = SDL_RWFromFile( joinpath(base_data_path, path), "wb" );
+	if ( replay_file == NULL ) {
+		fatal( "%s", SDL_GetError() );
+	}
+	SDL_WriteLE32( replay_file, REPLAY_MAGIC );
+	SDL_WriteLE32( replay_file, REPLAY_VERSION );
+	SDL_WriteLE32( replay_file, base_fps );
+	replay_mode = REPLAY_RECORD;
+}
+
+void replay_start_playback( const char *path )
+{
+	replay_file = SDL_RWFromFile( joinpath(base_data_path, path), "rb" );
+	if ( replay_file == NULL ) {
+		fatal( "%s", SDL_GetError() );
+	}
+	if ( SDL_ReadLE32(replay_file) != REPLAY_MAGIC || SDL_ReadLE32(replay_file) != REPLAY_VERSION ) {
+		fatal( "%s is not an input recording\n", path );
+	}
+	base_fps = SDL_ReadLE32( replay_file );
+	if ( base_fps <= 0 ) {
+		fatal( "%s has an invalid frame rate\n", path );
+	}
+	replay_mode = REPLAY_PLAYBACK;
+	replay_pending = 0;
+}
+
+void replay_stop( Uint32 frame )
+{
+	SDL_Event end;
+
+	if ( replay_mode == REPLAY_RECORD ) {
+		SDL_zero( end );
+		end.type = REPLAY_END;
+		replay_record( frame, &end );
+	}
+	if ( replay_file != NULL ) {
+		SDL_RWclose( replay_file );
+		replay_file = NULL;
+	}
+	replay_mode = REPLAY_OFF;
+}
+
+int replay_get_mode( )
+{
+	return replay_mode;
+}
+
+void replay_record( Uint32 frame, const SDL_Event *e )
+{
+	SDL_WriteLE32( replay_file, frame );
+	SDL_WriteLE32( replay_file, e->type );
+	switch ( e->type ) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		SDL_WriteLE32( replay_file, (Uint32)e->key.keysym.sym );
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		SDL_WriteU8( replay_file, e->button.button );
+		SDL_WriteLE32( replay_file, (Uint32)e->button.x );
+		SDL_WriteLE32( replay_file, (Uint32)e->button.y );
+		break;
+	case SDL_TEXTEDITING:
+		SDL_WriteLE32( replay_file, (Uint32)e->edit.start );
+		SDL_WriteLE32( replay_file, (Uint32)e->edit.length );
+		replay_write_text( e->edit.text );
+		break;
+	case SDL_TEXTINPUT:
+		replay_write_text( e->text.text );
+		break;
+	case SDL_MOUSEWHEEL:
+		SDL_WriteLE32( replay_file, (Uint32)e->wheel.x );
+		SDL_WriteLE32( replay_file, (Uint32)e->wheel.y );
+		break;
+	default:
+		break;
+	}
+}
+
+/* Reads ahead one record; returns 0 at the end of the recording */
+static int replay_read( )
+{
+	SDL_Event *e;
+
+	e = &replay_event;
+	if ( SDL_RWread(replay_file, &replay_frame, sizeof(replay_frame), 1) != 1 ) {
+		return 0;
+	}
+	replay_frame = SDL_SwapLE32( replay_frame );
+	SDL_zero( *e );
+	e->type = SDL_ReadLE32( replay_file );
+	switch ( e->type ) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		e->key.keysym.sym = (SDL_Keycode)SDL_ReadLE32( replay_file );
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		e->button.button = SDL_ReadU8( replay_file );
+		e->button.x = (Sint32)SDL_ReadLE32( replay_file );
+		e->button.y = (Sint32)SDL_ReadLE32( replay_file );
+		break;
+	case SDL_TEXTEDITING:
+		e->edit.start = (Sint32)SDL_ReadLE32( replay_file );
+		e->edit.length = (Sint32)SDL_ReadLE32( replay_file );
+		if ( replay_read_text(e->edit.text, sizeof(e->edit.text)) ) {
+			return 0;
+		}
+		break;
+	case SDL_TEXTINPUT:
+		if ( replay_read_text(e->text.text, sizeof(e->text.text)) ) {
+			return 0;
+		}
+		break;
+	case SDL_MOUSEWHEEL:
+		e->wheel.x = (Sint32)SDL_ReadLE32( replay_file );
+		e->wheel.y = (Sint32)SDL_ReadLE32( replay_file );
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+
+/* Fills e with the next recorded event due at or before frame; returns
+ * 0 when there are none left for this frame. */
+int replay_next( Uint32 frame, SDL_Event *e )
+{
+	if ( !replay_pending ) {
+		if ( !replay_read() ) {
+			return 0;
+		}
+		replay_pending = 1;
+	}
+	if ( replay_frame > frame || replay_event.type == REPLAY_END ) {
+		return 0;
+	}
+	*e = replay_event;
+	replay_pending = 0;
+	return 1;
+}
+
+int replay_finished( Uint32 frame )
+{
+	if ( !replay_pending ) {
+		replay_pending = replay_read( );
+	}
+	return !replay_pending || ( replay_event.type == REPLAY_END && replay_frame <= frame );
+}
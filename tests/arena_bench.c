@@ -0,0 +1,127 @@
+/*
+ * Benchmark for the arena allocator against the other allocators the
+ * engine state can have: the C library's realloc, which luaL_newstate
+ * uses, and a talloc pool, as with -p. Each one runs the same
+ * allocation-heavy Lua script in a fresh state, from creating the state
+ * to closing it.
+ *
+ * Usage: arena_bench [iterations] [pool megabytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../moonbase.h"
+
+#define BENCH_ITERATIONS	1000000
+#define BENCH_POOL_SIZE		64
+
+/* arena.c reports failures through fatal() */
+char fatal_buffer[ 4096 ];
+
+void log_printf( int level, const char *fmt, ... )
+{
+}
+
+void quit( int sig )
+{
+	fprintf( stderr, "%s", fatal_buffer );
+	exit( 1 );
+}
+
+/* Strings, small tables and closures, with a table now and then that
+ * grows past the arena's small block range */
+static const char *bench_script =
+	"local n = ...\n"
+	"local keep = {}\n"
+	"for i = 1, n do\n"
+	"	local t = { i, x = i, name = 'item' .. i }\n"
+	"	local f = function( ) return t.x end\n"
+	"	keep[i % 1024 + 1] = f\n"
+	"	if i % 256 == 0 then\n"
+	"		local big = {}\n"
+	"		for j = 1, 64 do big[j] = j end\n"
+	"		keep[i % 1024 + 1] = big\n"
+	"	end\n"
+	"end\n";
+
+static TALLOC_CTX *bench_pool;
+
+static void *libc_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+	if ( nsize == 0 ) {
+		free( ptr );
+		return NULL;
+	}
+	return realloc( ptr, nsize );
+}
+
+static void *pool_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+	if ( nsize == 0 ) {
+		talloc_free( ptr );
+		return NULL;
+	}
+	return talloc_realloc_size( bench_pool, ptr, nsize );
+}
+
+static double now( )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run( lua_Alloc alloc, int iterations )
+{
+	lua_State *s;
+	double start;
+
+	start = now( );
+	s = lua_newstate( alloc, NULL );
+	if ( s == NULL ) {
+		fprintf( stderr, "Failed to create Lua state\n" );
+		exit( 1 );
+	}
+	luaL_openlibs( s );
+	if ( luaL_loadstring(s, bench_script) != LUA_OK ) {
+		fprintf( stderr, "%s\n", lua_tostring(s, -1) );
+		exit( 1 );
+	}
+	lua_pushinteger( s, iterations );
+	if ( lua_pcall(s, 1, 0, 0) != LUA_OK ) {
+		fprintf( stderr, "%s\n", lua_tostring(s, -1) );
+		exit( 1 );
+	}
+	lua_close( s );
+	return now( ) - start;
+}
+
+int main( int argc, char **argv )
+{
+	const struct arena_stats *stats;
+	double libc, pool, arena;
+	size_t reserved;
+	int iterations, pool_size;
+
+	iterations = argc > 1 ? atoi( argv[1] ) : BENCH_ITERATIONS;
+	pool_size = argc > 2 ? atoi( argv[2] ) : BENCH_POOL_SIZE;
+	libc = run( libc_alloc, iterations );
+	bench_pool = talloc_pool( NULL, pool_size * (1024*1024) );
+	if ( bench_pool == NULL ) {
+		fprintf( stderr, "Failed to allocate talloc pool\n" );
+		return 1;
+	}
+	pool = run( pool_alloc, iterations );
+	talloc_free( bench_pool );
+	arena = run( arena_alloc, iterations );
+	stats = arena_get_stats( );
+	reserved = stats->reserved;
+	arena_shutdown( );
+	printf( "allocator  seconds  vs realloc\n" );
+	printf( "realloc   %8.3f  %9.2fx\n", libc, 1.0 );
+	printf( "talloc    %8.3f  %9.2fx\n", pool, libc / pool );
+	printf( "arena     %8.3f  %9.2fx\n", arena, libc / arena );
+	printf( "arena reserved %lu KB at close\n", (unsigned long)(reserved / 1024) );
+	return 0;
+}
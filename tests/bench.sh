@@ -0,0 +1,14 @@
+#!/bin/sh
+# Runs the engine-level benchmarks in tests/bench headless, against the
+# engine built in the given directory. Usage: tests/bench.sh [build dir]
+
+BUILD=${1:-build}
+GAME=$BUILD/bench.zip
+
+run( ) {
+	echo "== moonbase $*"
+	"$BUILD/moonbase" -x "$@" "$GAME" || exit 1
+}
+
+run -m sprites.lua
+run -m profiler.lua
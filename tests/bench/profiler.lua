@@ -0,0 +1,47 @@
+-- Overhead of the sampling profiler at its default interval. The same
+-- call-heavy workload runs in alternating rounds with the profiler off
+-- and on, so drift in clock speed hits both sides alike, and the check
+-- fails if profiling costs 5% or more.
+
+local ROUNDS = 20
+local LIMIT = 0.05
+
+local function fib( n )
+	if n < 2 then
+		return n
+	end
+	return fib( n - 1 ) + fib( n - 2 )
+end
+
+local function work( )
+	local t = {}
+	for i = 1, 20 do
+		t[#t + 1] = fib( 22 ) + i
+	end
+	return #t
+end
+
+local function time( )
+	local start = os.clock( )
+	work( )
+	return os.clock( ) - start
+end
+
+moonbase.event.update = function( )
+	local off, on = 0, 0
+	time( )
+	for i = 1, ROUNDS do
+		off = off + time( )
+		moonbase.profiler.start( "bench-profile.folded" )
+		on = on + time( )
+		moonbase.profiler.stop( )
+	end
+	local overhead = on / off - 1
+	print( string.format("profiler off %8.3f s", off) )
+	print( string.format("profiler on  %8.3f s", on) )
+	print( string.format("overhead     %8.2f%%", overhead * 100) )
+	if overhead >= LIMIT then
+		error( string.format("profiler overhead %.2f%% is over %.0f%%", overhead * 100, LIMIT * 100) )
+	end
+	moonbase.quit( )
+end
@@ -0,0 +1,51 @@
+-- Sprites per second drawn with one image:draw call per sprite against
+-- one image:drawBatch call per frame. Each way draws for a few seconds
+-- of wall time, frames included, so the renderer's share is counted.
+
+local SPRITES = 10000
+local SECONDS = 3
+
+local video = moonbase.video
+local atlas = video.canvas( 64, 64 )
+
+local positions = {}
+local batch = {}
+for i = 0, SPRITES - 1 do
+	local x, y = ( i * 37 ) % 800, ( i * 91 ) % 600
+	positions[#positions + 1] = x
+	positions[#positions + 1] = y
+	local n = #batch
+	batch[n + 1], batch[n + 2], batch[n + 3], batch[n + 4] = x, y, 16, 16
+	batch[n + 5], batch[n + 6], batch[n + 7], batch[n + 8] = 0, 0, 16, 16
+	batch[n + 9], batch[n + 10] = 0xffffffff, 0
+end
+
+local modes = {
+	{ name = "draw", frame = function()
+		for i = 1, #positions, 2 do
+			atlas:draw( positions[i], positions[i + 1], 16, 16 )
+		end
+	end },
+	{ name = "drawBatch", frame = function()
+		atlas:drawBatch( batch )
+	end },
+}
+
+local mode, frames, start = 1, 0, moonbase.getTicks( )
+
+moonbase.event.update = function( )
+	local now = moonbase.getTicks( )
+	if now - start >= SECONDS * 1000 then
+		local m = modes[mode]
+		m.rate = frames * SPRITES / ( (now - start) / 1000 )
+		print( string.format("%-10s %12.0f sprites/s", m.name, m.rate) )
+		mode, frames, start = mode + 1, 0, now
+		if mode > #modes then
+			print( string.format("speedup    %12.2fx", modes[2].rate / modes[1].rate) )
+			moonbase.quit( )
+		end
+		return
+	end
+	modes[mode].frame( )
+	frames = frames + 1
+end
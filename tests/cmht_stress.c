@@ -0,0 +1,272 @@
+/*
+ * Stress test and thread scaling benchmark for cmht.
+ *
+ * The stress test runs writers that each own a range of keys, inserting,
+ * checking and deleting them, while every thread also reads and bumps a
+ * set of shared counters through cmht_update. At the end each counter
+ * must equal the number of bumps made to it and the owned ranges must
+ * hold exactly what their writers left there.
+ *
+ * The benchmark then runs a read-mostly mix on 1..N threads and prints
+ * the throughput for each thread count. N defaults to the number of
+ * online CPUs; past that, threads only take turns and no speedup is to
+ * be expected.
+ *
+ * Usage: cmht_stress [max threads] [seconds per benchmark run]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "../mht.h"
+
+#define STRESS_THREADS		8
+#define STRESS_ROUNDS		200000
+#define STRESS_OWNED		1024
+#define STRESS_COUNTERS		64
+#define BENCH_KEYS		4096
+
+struct counter {
+	long	value;
+};
+
+/* Padded so the per-operation writes to seed and ops by one thread do
+ * not share a cache line with the next worker's */
+struct worker {
+	pthread_t	thread;
+	int		id;
+	unsigned int	seed;
+	long		bumps[ STRESS_COUNTERS ];
+	long		ops;
+	int		failed;
+	char		pad[ CMHT_CACHE_LINE ];
+};
+
+static struct cmht	*table;
+static int		stop;
+static double		bench_seconds = 1.0;
+
+static unsigned int next_random( unsigned int *seed )
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return *seed >> 8;
+}
+
+/* Keys are small integers cast to pointers; 0 would read as null */
+static void *counter_key( int i )
+{
+	return (void*)(uintptr_t)( i + 1 );
+}
+
+static void *owned_key( int worker, int i )
+{
+	return (void*)(uintptr_t)( STRESS_COUNTERS + 1 + worker * STRESS_OWNED + i );
+}
+
+static void free_entry( void *k, void *v )
+{
+	free( v );
+}
+
+static int bump( void *k, void *v, void *arg )
+{
+	((struct counter*)v)->value++;
+	return 0;
+}
+
+static int peek( void *k, void *v, void *arg )
+{
+	*(long*)arg = ((struct counter*)v)->value;
+	return 0;
+}
+
+static void *stress_thread( void *arg )
+{
+	struct worker *w;
+	struct counter *c;
+	void *v;
+	long value;
+	int i, n;
+
+	w = (struct worker*)arg;
+	for ( n = 0; n < STRESS_ROUNDS; ++n ) {
+		i = next_random( &w->seed ) % STRESS_COUNTERS;
+		switch ( next_random(&w->seed) % 4 ) {
+		case 0:
+			if ( cmht_update(table, counter_key(i), bump, NULL) != 0 ) {
+				w->failed = 1;
+			}
+			w->bumps[i]++;
+			break;
+		case 1:
+			if ( cmht_read(table, counter_key(i), peek, &value) != 0 || value < 0 ) {
+				w->failed = 1;
+			}
+			break;
+		default:
+			/* Owned keys are only written by this worker, so their
+			 * presence and contents are known exactly */
+			i = next_random( &w->seed ) % STRESS_OWNED;
+			if ( cmht_get(table, owned_key(w->id, i), &v) == 0 ) {
+				if ( ((struct counter*)v)->value != w->id * STRESS_OWNED + i ) {
+					w->failed = 1;
+				}
+				cmht_delete( table, owned_key(w->id, i) );
+			} else {
+				c = (struct counter*)malloc( sizeof(struct counter) );
+				c->value = w->id * STRESS_OWNED + i;
+				if ( cmht_set(table, owned_key(w->id, i), c, 0) != 0 ) {
+					w->failed = 1;
+				}
+			}
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int run_stress( )
+{
+	struct worker workers[ STRESS_THREADS ];
+	struct counter *c;
+	long expected, value;
+	void *v;
+	int i, j, failed, present;
+
+	table = cmht_ptrk_new( 16, 16, free_entry );
+	for ( i = 0; i < STRESS_COUNTERS; ++i ) {
+		c = (struct counter*)calloc( 1, sizeof(struct counter) );
+		cmht_set( table, counter_key(i), c, 0 );
+	}
+	memset( workers, 0, sizeof(workers) );
+	for ( i = 0; i < STRESS_THREADS; ++i ) {
+		workers[i].id = i;
+		workers[i].seed = 7919u * ( i + 1 );
+		pthread_create( &workers[i].thread, NULL, stress_thread, &workers[i] );
+	}
+	failed = 0;
+	for ( i = 0; i < STRESS_THREADS; ++i ) {
+		pthread_join( workers[i].thread, NULL );
+		if ( workers[i].failed ) {
+			fprintf( stderr, "worker %d saw an inconsistent entry\n", i );
+			failed = 1;
+		}
+	}
+	for ( i = 0; i < STRESS_COUNTERS; ++i ) {
+		expected = 0;
+		for ( j = 0; j < STRESS_THREADS; ++j ) {
+			expected += workers[j].bumps[i];
+		}
+		cmht_read( table, counter_key(i), peek, &value );
+		if ( value != expected ) {
+			fprintf( stderr, "counter %d is %ld, expected %ld\n", i, value, expected );
+			failed = 1;
+		}
+	}
+	present = 0;
+	for ( i = 0; i < STRESS_THREADS; ++i ) {
+		for ( j = 0; j < STRESS_OWNED; ++j ) {
+			if ( cmht_get(table, owned_key(i, j), &v) == 0 ) {
+				present++;
+			}
+		}
+	}
+	if ( cmht_size(table) != (size_t)( STRESS_COUNTERS + present ) ) {
+		fprintf( stderr, "size is %lu, expected %d\n",
+			(unsigned long)cmht_size(table), STRESS_COUNTERS + present );
+		failed = 1;
+	}
+	cmht_free( table );
+	printf( "stress: %d threads x %d rounds %s\n", STRESS_THREADS, STRESS_ROUNDS,
+		failed ? "FAILED" : "ok" );
+	return failed;
+}
+
+/* Nine reads to every refcount style update, like the asset registry */
+static void *bench_thread( void *arg )
+{
+	struct worker *w;
+	long value;
+	int i;
+
+	w = (struct worker*)arg;
+	while ( !__atomic_load_n(&stop, __ATOMIC_RELAXED) ) {
+		i = next_random( &w->seed ) % BENCH_KEYS;
+		if ( next_random(&w->seed) % 10 == 0 ) {
+			cmht_update( table, counter_key(i), bump, NULL );
+		} else {
+			cmht_read( table, counter_key(i), peek, &value );
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+static double now( )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_bench( int max_threads )
+{
+	struct worker *workers;
+	struct timespec pause;
+	struct counter *c;
+	double start, elapsed, base;
+	long ops;
+	int i, n;
+
+	table = cmht_ptrk_new( 16, BENCH_KEYS, free_entry );
+	for ( i = 0; i < BENCH_KEYS; ++i ) {
+		c = (struct counter*)calloc( 1, sizeof(struct counter) );
+		cmht_set( table, counter_key(i), c, 0 );
+	}
+	workers = (struct worker*)calloc( max_threads, sizeof(struct worker) );
+	base = 0;
+	printf( "threads  Mops/s  speedup\n" );
+	for ( n = 1; n <= max_threads; ++n ) {
+		__atomic_store_n( &stop, 0, __ATOMIC_RELAXED );
+		memset( workers, 0, max_threads * sizeof(struct worker) );
+		start = now( );
+		for ( i = 0; i < n; ++i ) {
+			workers[i].seed = 104729u * ( i + 1 );
+			pthread_create( &workers[i].thread, NULL, bench_thread, &workers[i] );
+		}
+		pause.tv_sec = (time_t)bench_seconds;
+		pause.tv_nsec = (long)( (bench_seconds - pause.tv_sec) * 1e9 );
+		nanosleep( &pause, NULL );
+		__atomic_store_n( &stop, 1, __ATOMIC_RELAXED );
+		ops = 0;
+		for ( i = 0; i < n; ++i ) {
+			pthread_join( workers[i].thread, NULL );
+			ops += workers[i].ops;
+		}
+		elapsed = now( ) - start;
+		if ( n == 1 ) {
+			base = ops / elapsed;
+		}
+		printf( "%7d  %6.2f  %7.2f\n", n, ops / elapsed / 1e6, ops / elapsed / base );
+	}
+	free( workers );
+	cmht_free( table );
+}
+
+int main( int argc, char **argv )
+{
+	int max_threads, cpus;
+
+	cpus = (int)sysconf( _SC_NPROCESSORS_ONLN );
+	max_threads = argc > 1 ? atoi( argv[1] ) : cpus;
+	if ( argc > 2 ) {
+		bench_seconds = atof( argv[2] );
+	}
+	if ( run_stress() ) {
+		return 1;
+	}
+	printf( "%d CPUs online\n", cpus );
+	run_bench( max_threads > 0 ? max_threads : 1 );
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Microbenchmark for the luacom userdata helpers.
+ *
+ * Object creation and method calls are timed from a Lua loop, once with
+ * the way userdata used to be made, where every creation ran
+ * luaL_newmetatable and luaL_setfuncs and every method checked its
+ * argument with luaL_checkudata, and once with luacom_create_object and
+ * luacom_check_object. Reading an { x, y, w, h } argument is compared
+ * the same way, through luacom_read_array and through luacom_read_rect.
+ * Each figure is the cost of one call as seen from a script, loop
+ * overhead included.
+ *
+ * Usage: luacom_bench [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../luacom.h"
+
+#define BENCH_ITERATIONS	2000000
+
+struct bench_point {
+	int	x, y;
+};
+
+static int old_get( lua_State *s );
+static int new_get( lua_State *s );
+
+static luaL_Reg old_methods[] = {
+	{ "get", old_get },
+	{ NULL, NULL }
+};
+
+static luaL_Reg new_methods[] = {
+	{ "get", new_get },
+	{ NULL, NULL }
+};
+
+static struct luacom_class new_class = { "bench_new", new_methods };
+
+static int old_create( lua_State *s )
+{
+	struct bench_point *p;
+
+	p = (struct bench_point*)lua_newuserdata( s, sizeof(struct bench_point) );
+	p->x = 1;
+	p->y = 2;
+	luaL_newmetatable( s, "bench_old" );
+	luaL_setfuncs( s, old_methods, 0 );
+	lua_pushvalue( s, -1 );
+	lua_setfield( s, -2, "__index" );
+	lua_setmetatable( s, -2 );
+	return 1;
+}
+
+static int old_get( lua_State *s )
+{
+	struct bench_point *p;
+
+	p = (struct bench_point*)luaL_checkudata( s, 1, "bench_old" );
+	lua_pushinteger( s, p->x );
+	return 1;
+}
+
+static int new_create( lua_State *s )
+{
+	struct bench_point p;
+
+	p.x = 1;
+	p.y = 2;
+	luacom_create_object( s, &new_class, &p, sizeof(p) );
+	return 1;
+}
+
+static int new_get( lua_State *s )
+{
+	struct bench_point *p;
+
+	p = (struct bench_point*)luacom_check_object( s, 1, &new_class );
+	lua_pushinteger( s, p->x );
+	return 1;
+}
+
+static int old_rect( lua_State *s )
+{
+	int x, y, w, h;
+
+	luacom_read_array( s, 1, "iiii", 1, &x, 2, &y, 3, &w, 4, &h );
+	lua_pushinteger( s, x + y + w + h );
+	return 1;
+}
+
+static int new_rect( lua_State *s )
+{
+	int x, y, w, h;
+
+	luacom_read_rect( s, 1, &x, &y, &w, &h );
+	lua_pushinteger( s, x + y + w + h );
+	return 1;
+}
+
+static double now( )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs chunk with the C function fn and the iteration count as its
+ * arguments; returns nanoseconds per iteration */
+static double run( lua_State *s, const char *chunk, lua_CFunction fn, int iterations )
+{
+	double start;
+
+	if ( luaL_loadstring(s, chunk) != LUA_OK ) {
+		fprintf( stderr, "%s\n", lua_tostring(s, -1) );
+		exit( 1 );
+	}
+	lua_pushcfunction( s, fn );
+	lua_pushinteger( s, iterations );
+	lua_gc( s, LUA_GCCOLLECT, 0 );
+	start = now( );
+	if ( lua_pcall(s, 2, 0, 0) != LUA_OK ) {
+		fprintf( stderr, "%s\n", lua_tostring(s, -1) );
+		exit( 1 );
+	}
+	return ( now() - start ) * 1e9 / iterations;
+}
+
+static void compare( lua_State *s, const char *name, const char *chunk,
+	lua_CFunction old_fn, lua_CFunction new_fn, int iterations )
+{
+	double old_ns, new_ns;
+
+	old_ns = run( s, chunk, old_fn, iterations );
+	new_ns = run( s, chunk, new_fn, iterations );
+	printf( "%-10s %8.1f %8.1f %8.2fx\n", name, old_ns, new_ns, old_ns / new_ns );
+}
+
+int main( int argc, char **argv )
+{
+	lua_State *s;
+	int iterations;
+
+	iterations = argc > 1 ? atoi( argv[1] ) : BENCH_ITERATIONS;
+	s = luaL_newstate( );
+	luaL_openlibs( s );
+	printf( "ns/call       old      new  speedup\n" );
+	compare( s, "create",
+		"local new, n = ...\n"
+		"for i = 1, n do new( ) end\n",
+		old_create, new_create, iterations );
+	compare( s, "method",
+		"local new, n = ...\n"
+		"local o = new( )\n"
+		"for i = 1, n do o:get( ) end\n",
+		old_create, new_create, iterations );
+	compare( s, "readRect",
+		"local fn, n = ...\n"
+		"local r = { 1, 2, 3, 4 }\n"
+		"for i = 1, n do fn( r ) end\n",
+		old_rect, new_rect, iterations );
+	lua_close( s );
+	return 0;
+}
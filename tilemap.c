@@ -0,0 +1,438 @@
+#include "moonbase.h"
+
+/* Chunks are roughly this many pixels on a side */
+#define TILEMAP_CHUNK_PIXELS	256
+#define TILEMAP_MAX_CHUNK_TILES	32
+#define TILEMAP_MAX_CACHED	128
+
+struct tilemap_chunk {
+	void	*image;
+	int	dirty;
+	Uint32	stamp;
+};
+
+struct tilemap {
+	void			*atlas;
+	struct size		tile;
+	int			atlas_columns;
+	int			columns, rows;
+	Uint16			*tiles;
+	struct size		chunk;
+	int			chunk_columns, chunk_rows;
+	struct tilemap_chunk	*chunks;
+	int			num_cached;
+	Uint32			stamp;
+	struct tilemap		*next;
+};
+
+static struct render_buffer	tilemap_buffer;
+static int			tilemap_count;
+static struct tilemap		*tilemap_list;
+
+struct tilemap *tilemap_new( void *atlas, const struct size *tile, int columns, int rows )
+{
+	struct tilemap *map;
+	struct size atlas_size;
+
+	map = (struct tilemap*)SDL_calloc( 1, sizeof(struct tilemap) );
+	if ( map == NULL ) {
+		fatal( "Failed to allocate tilemap\n" );
+	}
+	map->atlas = asset_acquire( atlas );
+	map->tile = *tile;
+	image_get_size( atlas, &atlas_size );
+	map->atlas_columns = SDL_max( atlas_size.w / tile->w, 1 );
+	map->columns = columns;
+	map->rows = rows;
+	map->tiles = (Uint16*)SDL_calloc( (size_t)columns * rows, sizeof(Uint16) );
+	map->chunk.w = SDL_min( SDL_max(TILEMAP_CHUNK_PIXELS / tile->w, 1), TILEMAP_MAX_CHUNK_TILES );
+	map->chunk.h = SDL_min( SDL_max(TILEMAP_CHUNK_PIXELS / tile->h, 1), TILEMAP_MAX_CHUNK_TILES );
+	map->chunk_columns = ( columns + map->chunk.w - 1 ) / map->chunk.w;
+	map->chunk_rows = ( rows + map->chunk.h - 1 ) / map->chunk.h;
+	map->chunks = (struct tilemap_chunk*)SDL_calloc( map->chunk_columns * map->chunk_rows, sizeof(struct tilemap_chunk) );
+	if ( map->tiles == NULL || map->chunks == NULL ) {
+		fatal( "Failed to allocate %dx%d tilemap\n", columns, rows );
+	}
+	++tilemap_count;
+	map->next = tilemap_list;
+	tilemap_list = map;
+	return map;
+}
+
+static void tilemap_drop_chunk( struct tilemap *map, struct tilemap_chunk *chunk )
+{
+	if ( chunk->image != NULL ) {
+		asset_release( chunk->image );
+		chunk->image = NULL;
+		--map->num_cached;
+	}
+}
+
+void tilemap_free( struct tilemap *map )
+{
+	struct tilemap **p;
+	int i;
+
+	for ( p = &tilemap_list; *p != NULL; p = &(*p)->next ) {
+		if ( *p == map ) {
+			*p = map->next;
+			break;
+		}
+	}
+	for ( i = 0; i < map->chunk_columns * map->chunk_rows; ++i ) {
+		tilemap_drop_chunk( map, &map->chunks[i] );
+	}
+	asset_release( map->atlas );
+	SDL_free( map->chunks );
+	SDL_free( map->tiles );
+	SDL_free( map );
+	if ( --tilemap_count == 0 ) {
+		render_buffer_release( &tilemap_buffer );
+	}
+}
+
+/* Drops every cached chunk of every tilemap; chunks are rendered again
+ * as they come into view. */
+void tilemap_release_all( )
+{
+	struct tilemap *map;
+	int i;
+
+	for ( map = tilemap_list; map != NULL; map = map->next ) {
+		for ( i = 0; i < map->chunk_columns * map->chunk_rows; ++i ) {
+			tilemap_drop_chunk( map, &map->chunks[i] );
+		}
+	}
+}
+
+void tilemap_get_size( struct tilemap *map, struct size *size )
+{
+	size->w = map->columns;
+	size->h = map->rows;
+}
+
+int tilemap_get( struct tilemap *map, int column, int row )
+{
+	if ( column < 0 || row < 0 || column >= map->columns || row >= map->rows ) {
+		return 0;
+	}
+	return map->tiles[ row * map->columns + column ];
+}
+
+void tilemap_set( struct tilemap *map, int column, int row, int tile )
+{
+	Uint16 *t;
+
+	if ( column < 0 || row < 0 || column >= map->columns || row >= map->rows ) {
+		return;
+	}
+	t = &map->tiles[ row * map->columns + column ];
+	if ( *t != tile ) {
+		*t = tile;
+		map->chunks[ (row / map->chunk.h) * map->chunk_columns + column / map->chunk.w ].dirty = 1;
+	}
+}
+
+void tilemap_invalidate( struct tilemap *map )
+{
+	int i;
+
+	for ( i = 0; i < map->chunk_columns * map->chunk_rows; ++i ) {
+		map->chunks[i].dirty = 1;
+	}
+}
+
+/* Fills sprites for the tiles of one chunk that overlap view, clipped to
+ * it and positioned relative to origin. */
+static int tilemap_chunk_sprites( struct tilemap *map, int cx, int cy, const SDL_Rect *view, const struct point *origin, struct sprite *sprites )
+{
+	int x, y, x0, y0, x1, y1, n, t;
+	SDL_Rect tile, clip;
+
+	x0 = SDL_max( cx * map->chunk.w, view->x / map->tile.w );
+	y0 = SDL_max( cy * map->chunk.h, view->y / map->tile.h );
+	x1 = SDL_min( SDL_min((cx + 1) * map->chunk.w, map->columns), (view->x + view->w + map->tile.w - 1) / map->tile.w );
+	y1 = SDL_min( SDL_min((cy + 1) * map->chunk.h, map->rows), (view->y + view->h + map->tile.h - 1) / map->tile.h );
+	n = 0;
+	tile.w = map->tile.w;
+	tile.h = map->tile.h;
+	for ( y = y0; y < y1; ++y ) {
+		for ( x = x0; x < x1; ++x ) {
+			t = map->tiles[ y * map->columns + x ];
+			if ( t == 0 ) {
+				continue;
+			}
+			tile.x = x * map->tile.w;
+			tile.y = y * map->tile.h;
+			if ( !SDL_IntersectRect(&tile, view, &clip) ) {
+				continue;
+			}
+			sprites[n].source.x = ( (t - 1) % map->atlas_columns ) * map->tile.w + clip.x - tile.x;
+			sprites[n].source.y = ( (t - 1) / map->atlas_columns ) * map->tile.h + clip.y - tile.y;
+			sprites[n].source.w = clip.w;
+			sprites[n].source.h = clip.h;
+			sprites[n].destination.x = clip.x - origin->x;
+			sprites[n].destination.y = clip.y - origin->y;
+			sprites[n].destination.w = clip.w;
+			sprites[n].destination.h = clip.h;
+			sprites[n].tint = 0xffffffff;
+			sprites[n].angle = 0;
+			++n;
+		}
+	}
+	return n;
+}
+
+static void tilemap_evict( struct tilemap *map )
+{
+	int i, oldest;
+
+	oldest = -1;
+	for ( i = 0; i < map->chunk_columns * map->chunk_rows; ++i ) {
+		if ( map->chunks[i].image == NULL || map->chunks[i].stamp == map->stamp ) {
+			continue;
+		}
+		if ( oldest == -1 || (Sint32)(map->chunks[i].stamp - map->chunks[oldest].stamp) < 0 ) {
+			oldest = i;
+		}
+	}
+	if ( oldest != -1 ) {
+		tilemap_drop_chunk( map, &map->chunks[oldest] );
+	}
+}
+
+/* Returns the cached texture of a chunk, rendering it first if it is new
+ * or dirty, or NULL if it cannot be cached. */
+static void *tilemap_chunk_image( struct tilemap *map, int cx, int cy, const SDL_Rect *bounds )
+{
+	struct sprite *sprites;
+	struct tilemap_chunk *chunk;
+	SDL_Texture *texture;
+	struct point origin;
+	int n;
+
+	chunk = &map->chunks[ cy * map->chunk_columns + cx ];
+	chunk->stamp = map->stamp;
+	if ( chunk->image == NULL ) {
+		if ( !SDL_RenderTargetSupported(video_renderer) ) {
+			return NULL;
+		}
+		if ( map->num_cached >= TILEMAP_MAX_CACHED ) {
+			tilemap_evict( map );
+		}
+		texture = SDL_CreateTexture( video_renderer, SDL_PIXELFORMAT_RGBA8888,
+			SDL_TEXTUREACCESS_TARGET, bounds->w, bounds->h );
+		if ( texture == NULL ) {
+			return NULL;
+		}
+		SDL_SetTextureBlendMode( texture, SDL_BLENDMODE_BLEND );
+		chunk->image = asset_create( NULL, texture, ASSET_IMAGE );
+		chunk->dirty = 1;
+		++map->num_cached;
+	}
+	if ( chunk->dirty ) {
+		origin.x = bounds->x;
+		origin.y = bounds->y;
+		sprites = image_reserve_batch( TILEMAP_MAX_CHUNK_TILES * TILEMAP_MAX_CHUNK_TILES );
+		n = tilemap_chunk_sprites( map, cx, cy, bounds, &origin, sprites );
+		if ( render_begin(&tilemap_buffer) ) {
+			return NULL;
+		}
+		render_sprites( map->atlas, sprites, n );
+		render_end( &tilemap_buffer );
+		render_to_texture( &tilemap_buffer, asset_image_handle(chunk->image), 1 );
+		render_buffer_clear( &tilemap_buffer );
+		chunk->dirty = 0;
+	}
+	return chunk->image;
+}
+
+void tilemap_draw( struct tilemap *map, const struct rectangle *camera, const struct point *position )
+{
+	struct sprite *sprites;
+	SDL_Rect world, view, bounds, clip;
+	struct rectangle src, dst;
+	struct point origin;
+	void *image;
+	int cx, cy, cx0, cy0, cx1, cy1, n;
+
+	world.x = 0;
+	world.y = 0;
+	world.w = map->columns * map->tile.w;
+	world.h = map->rows * map->tile.h;
+	if ( !SDL_IntersectRect((const SDL_Rect*)camera, &world, &view) ) {
+		return;
+	}
+	origin.x = camera->x - position->x;
+	origin.y = camera->y - position->y;
+	bounds.w = map->chunk.w * map->tile.w;
+	bounds.h = map->chunk.h * map->tile.h;
+	cx0 = view.x / bounds.w;
+	cy0 = view.y / bounds.h;
+	cx1 = ( view.x + view.w - 1 ) / bounds.w;
+	cy1 = ( view.y + view.h - 1 ) / bounds.h;
+	++map->stamp;
+	for ( cy = cy0; cy <= cy1; ++cy ) {
+		for ( cx = cx0; cx <= cx1; ++cx ) {
+			bounds.x = cx * map->chunk.w * map->tile.w;
+			bounds.y = cy * map->chunk.h * map->tile.h;
+			bounds.w = SDL_min( map->chunk.w * map->tile.w, world.w - bounds.x );
+			bounds.h = SDL_min( map->chunk.h * map->tile.h, world.h - bounds.y );
+			SDL_IntersectRect( &bounds, &view, &clip );
+			image = tilemap_chunk_image( map, cx, cy, &bounds );
+			if ( image == NULL ) {
+				sprites = image_reserve_batch( TILEMAP_MAX_CHUNK_TILES * TILEMAP_MAX_CHUNK_TILES );
+				n = tilemap_chunk_sprites( map, cx, cy, &clip, &origin, sprites );
+				render_sprites( map->atlas, sprites, n );
+				continue;
+			}
+			src.x = clip.x - bounds.x;
+			src.y = clip.y - bounds.y;
+			src.w = clip.w;
+			src.h = clip.h;
+			dst.x = clip.x - origin.x;
+			dst.y = clip.y - origin.y;
+			dst.w = clip.w;
+			dst.h = clip.h;
+			render_copy( image, &src, &dst );
+		}
+	}
+}
+
+static int moonbase_tilemap_get( lua_State *s )
+{
+	struct tilemap *map;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	lua_pushinteger( s, tilemap_get(map, luaL_checkint(s, 2) - 1, luaL_checkint(s, 3) - 1) );
+	return 1;
+}
+
+/* tilemap:set( column, row, tile ), where tile is 0 for empty or
+ * 1..TILEMAP_MAX_TILE */
+static int moonbase_tilemap_set( lua_State *s )
+{
+	struct tilemap *map;
+	lua_Integer tile;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	tile = luaL_checkinteger( s, 4 );
+	luaL_argcheck( s, tile >= 0 && tile <= TILEMAP_MAX_TILE, 4, "tile out of range" );
+	tilemap_set( map, luaL_checkint(s, 2) - 1, luaL_checkint(s, 3) - 1, (int)tile );
+	return 0;
+}
+
+/* tilemap:load( tiles ) with the tiles row by row, as for set */
+static int moonbase_tilemap_load( lua_State *s )
+{
+	struct tilemap *map;
+	lua_Integer tile;
+	int i, n, isnum;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	luaL_checktype( s, 2, LUA_TTABLE );
+	n = SDL_min( (int)lua_rawlen(s, 2), map->columns * map->rows );
+	/* Before loading, so a bad tile part way still leaves the tiles
+	 * loaded so far to be drawn */
+	tilemap_invalidate( map );
+	for ( i = 0; i < n; ++i ) {
+		lua_rawgeti( s, 2, i + 1 );
+		tile = lua_tointegerx( s, -1, &isnum );
+		if ( !isnum ) {
+			luaL_argerror( s, 2, lua_pushfstring(s, "number expected at [%d], got %s", i + 1, luaL_typename(s, -1)) );
+		}
+		if ( tile < 0 || tile > TILEMAP_MAX_TILE ) {
+			luaL_argerror( s, 2, lua_pushfstring(s, "tile out of range at [%d]", i + 1) );
+		}
+		map->tiles[i] = (Uint16)tile;
+		lua_pop( s, 1 );
+	}
+	return 0;
+}
+
+static int moonbase_tilemap_draw( lua_State *s )
+{
+	struct tilemap *map;
+	struct rectangle camera;
+	struct point position;
+	int sized;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	luaL_argcheck( s, lua_type(s, 2) != LUA_TNUMBER, 2, "camera must be a single value" );
+	geometry_check_rect( s, 2, &camera, &sized );
+	luaL_argcheck( s, sized, 2, "rectangle expected" );
+	if ( !lua_isnoneornil(s, 3) ) {
+		luaL_argcheck( s, lua_type(s, 3) != LUA_TNUMBER, 3, "position must be a single value" );
+		geometry_check_point( s, 3, &position );
+	} else {
+		position.x = 0;
+		position.y = 0;
+	}
+	tilemap_draw( map, &camera, &position );
+	return 0;
+}
+
+static int moonbase_tilemap_invalidate( lua_State *s )
+{
+	struct tilemap *map;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	tilemap_invalidate( map );
+	return 0;
+}
+
+static int moonbase_tilemap_get_size( lua_State *s )
+{
+	struct tilemap *map;
+	struct size size;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	tilemap_get_size( map, &size );
+	luacom_push_size( s, size.w, size.h );
+	return 1;
+}
+
+static int moonbase_tilemap_gc( lua_State *s )
+{
+	struct tilemap *map;
+
+	map = *(struct tilemap**)luacom_check_object( s, 1, &moonbase_tilemap_class );
+	tilemap_free( map );
+	return 0;
+}
+
+luaL_Reg moonbase_tilemap_methods[] = {
+	{ "get", moonbase_tilemap_get },
+	{ "set", moonbase_tilemap_set },
+	{ "load", moonbase_tilemap_load },
+	{ "draw", moonbase_tilemap_draw },
+	{ "invalidate", moonbase_tilemap_invalidate },
+	{ "getSize", moonbase_tilemap_get_size },
+	{ "__gc", moonbase_tilemap_gc },
+	{ NULL, NULL }
+};
+
+struct luacom_class moonbase_tilemap_class = { "moonbase_tilemap", moonbase_tilemap_methods };
+
+int moonbase_video_tilemap( lua_State *s )
+{
+	void *atlas;
+	struct size tile;
+	int columns, rows;
+	struct tilemap *map;
+
+	atlas = *(void**)luacom_check_object( s, 1, &moonbase_image_class );
+	tile.w = luaL_checkint( s, 2 );
+	tile.h = luaL_checkint( s, 3 );
+	columns = luaL_checkint( s, 4 );
+	rows = luaL_checkint( s, 5 );
+	luaL_argcheck( s, tile.w > 0 && tile.h > 0, 2, "tile size must be positive" );
+	luaL_argcheck( s, columns > 0 && rows > 0, 4, "map size must be positive" );
+	/* Tile counts and pixel extents are ints throughout */
+	luaL_argcheck( s, (size_t)columns * rows <= INT_MAX, 4, "map has too many tiles" );
+	luaL_argcheck( s, (size_t)columns * tile.w <= INT_MAX && (size_t)rows * tile.h <= INT_MAX,
+		4, "map is too large in pixels" );
+	map = tilemap_new( atlas, &tile, columns, rows );
+	luacom_create_object( s, &moonbase_tilemap_class, &map, sizeof(map) );
+	return 1;
+}
@@ -0,0 +1,118 @@
+#include "moonbase.h"
+
+/* A summary of the phase percentiles is logged at LOG_DEBUG this often */
+#define TIMING_LOG_INTERVAL	5000
+
+static const char *timing_names[ TIMING_PHASES ] = {
+	"input",
+	"update",
+	"gc",
+	"submit",
+	"present",
+	"frame"
+};
+
+static float	timing_samples[ TIMING_PHASES ][ TIMING_WINDOW ];
+static int	timing_count;
+static int	timing_next;
+static Uint64	timing_frame_start;
+static Uint64	timing_phase_start;
+static Uint64	timing_frequency;
+static Uint32	timing_last_log;
+
+void timing_initialize( )
+{
+	timing_frequency = SDL_GetPerformanceFrequency( );
+	timing_count = 0;
+	timing_next = 0;
+	timing_last_log = SDL_GetTicks( );
+}
+
+const char *timing_get_name( int phase )
+{
+	return timing_names[ phase ];
+}
+
+void timing_begin_frame( )
+{
+	timing_frame_start = SDL_GetPerformanceCounter( );
+	timing_phase_start = timing_frame_start;
+}
+
+/* Attributes the time since the previous mark to phase */
+void timing_mark( int phase )
+{
+	Uint64 now;
+
+	now = SDL_GetPerformanceCounter( );
+	timing_samples[ phase ][ timing_next ] = (float)( (now - timing_phase_start) * 1000.0 / timing_frequency );
+	timing_phase_start = now;
+}
+
+static void timing_log( )
+{
+	struct timing_percentiles p[ TIMING_PHASES ];
+	int i;
+
+	for ( i = 0; i < TIMING_PHASES; ++i ) {
+		timing_get_percentiles( i, &p[i] );
+	}
+	log_printf( LOG_DEBUG, "frame phases over %d frames (ms p50/p95/p99/max): "
+		"input %.2f/%.2f/%.2f/%.2f, update %.2f/%.2f/%.2f/%.2f, "
+		"gc %.2f/%.2f/%.2f/%.2f, submit %.2f/%.2f/%.2f/%.2f, "
+		"present %.2f/%.2f/%.2f/%.2f, frame %.2f/%.2f/%.2f/%.2f",
+		timing_count,
+		p[0].p50, p[0].p95, p[0].p99, p[0].max,
+		p[1].p50, p[1].p95, p[1].p99, p[1].max,
+		p[2].p50, p[2].p95, p[2].p99, p[2].max,
+		p[3].p50, p[3].p95, p[3].p99, p[3].max,
+		p[4].p50, p[4].p95, p[4].p99, p[4].max,
+		p[5].p50, p[5].p95, p[5].p99, p[5].max );
+}
+
+void timing_end_frame( )
+{
+	Uint32 now;
+
+	timing_samples[ TIMING_FRAME ][ timing_next ] = (float)(
+		(SDL_GetPerformanceCounter() - timing_frame_start) * 1000.0 / timing_frequency );
+	timing_next = ( timing_next + 1 ) % TIMING_WINDOW;
+	if ( timing_count < TIMING_WINDOW ) {
+		++timing_count;
+	}
+	now = SDL_GetTicks( );
+	if ( now - timing_last_log >= TIMING_LOG_INTERVAL ) {
+		timing_last_log = now;
+		if ( log_get_verbosity() >= LOG_DEBUG ) {
+			timing_log( );
+		}
+	}
+}
+
+static int timing_compare( const void *a, const void *b )
+{
+	float x, y;
+
+	x = *(const float*)a;
+	y = *(const float*)b;
+	return ( x < y ) ? -1 : ( x > y );
+}
+
+/* Nearest-rank percentiles over the last TIMING_WINDOW frames */
+void timing_get_percentiles( int phase, struct timing_percentiles *p )
+{
+	float sorted[ TIMING_WINDOW ];
+	int n;
+
+	n = timing_count;
+	if ( n == 0 ) {
+		memset( p, 0, sizeof(*p) );
+		return;
+	}
+	memcpy( sorted, timing_samples[phase], n * sizeof(float) );
+	SDL_qsort( sorted, n, sizeof(float), timing_compare );
+	p->p50 = sorted[ (n * 50 + 99) / 100 - 1 ];
+	p->p95 = sorted[ (n * 95 + 99) / 100 - 1 ];
+	p->p99 = sorted[ (n * 99 + 99) / 100 - 1 ];
+	p->max = sorted[ n - 1 ];
+}
@@ -0,0 +1,273 @@
+#include "moonbase.h"
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL	__declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL	__thread
+#endif
+
+/* Events kept per thread; older ones are overwritten. Must be a power
+ * of two. */
+#define TRACE_RING_SIZE		65536
+#define TRACE_MAX_DEPTH		64
+
+struct trace_event {
+	const char	*name;
+	Uint64		start, end;
+};
+
+struct trace_stack {
+	int		depth;
+	const char	*names[ TRACE_MAX_DEPTH ];
+	Uint64		starts[ TRACE_MAX_DEPTH ];
+};
+
+/* Each thread writes only to its own buffer, so recording needs no
+ * locks; the lock only guards adding buffers to the list. Script zones
+ * have their own stack, so a zone a script leaves open cannot mis-nest
+ * the engine's. */
+struct trace_buffer {
+	SDL_threadID		thread;
+	SDL_atomic_t		written;
+	struct trace_stack	engine, script;
+	struct trace_event	events[ TRACE_RING_SIZE ];
+	struct trace_buffer	*next;
+};
+
+int					trace_enabled;
+static char				*trace_path;
+static struct trace_buffer		*trace_buffers;
+static SDL_SpinLock			trace_lock;
+static struct mht			*trace_names;
+static Uint64				trace_origin;
+static TRACE_THREAD_LOCAL struct trace_buffer	*trace_local;
+
+static void trace_free_name( void *k, void *v )
+{
+	SDL_free( k );
+}
+
+/* Tracing is started once, from the command line, and runs until the
+ * engine quits. */
+void trace_start( const char *path )
+{
+	trace_path = SDL_strdup( path );
+	trace_names = mht_strk_new( 64, trace_free_name );
+	trace_origin = SDL_GetPerformanceCounter( );
+	trace_enabled = 1;
+}
+
+static struct trace_buffer *trace_register( )
+{
+	struct trace_buffer *b;
+
+	b = (struct trace_buffer*)SDL_calloc( 1, sizeof(struct trace_buffer) );
+	if ( b == NULL ) {
+		fatal( "Failed to allocate trace buffer\n" );
+	}
+	b->thread = SDL_ThreadID( );
+	SDL_AtomicLock( &trace_lock );
+	b->next = trace_buffers;
+	trace_buffers = b;
+	SDL_AtomicUnlock( &trace_lock );
+	trace_local = b;
+	return b;
+}
+
+static void trace_push( struct trace_stack *st, const char *name )
+{
+	if ( st->depth < TRACE_MAX_DEPTH ) {
+		st->names[ st->depth ] = name;
+		st->starts[ st->depth ] = SDL_GetPerformanceCounter( );
+	}
+	st->depth++;
+}
+
+static void trace_pop( struct trace_buffer *b, struct trace_stack *st )
+{
+	struct trace_event *e;
+	int n;
+
+	if ( --st->depth < TRACE_MAX_DEPTH ) {
+		n = SDL_AtomicGet( &b->written );
+		e = &b->events[ n & (TRACE_RING_SIZE - 1) ];
+		e->name = st->names[ st->depth ];
+		e->start = st->starts[ st->depth ];
+		e->end = SDL_GetPerformanceCounter( );
+		SDL_AtomicSet( &b->written, n + 1 );
+	}
+}
+
+void trace_begin( const char *name )
+{
+	struct trace_buffer *b;
+
+	b = trace_local ? trace_local : trace_register( );
+	trace_push( &b->engine, name );
+}
+
+void trace_end( )
+{
+	struct trace_buffer *b;
+
+	b = trace_local;
+	if ( b == NULL || b->engine.depth == 0 ) {
+		return;
+	}
+	trace_pop( b, &b->engine );
+}
+
+void trace_begin_script( const char *name )
+{
+	struct trace_buffer *b;
+
+	b = trace_local ? trace_local : trace_register( );
+	trace_push( &b->script, name );
+}
+
+void trace_end_script( )
+{
+	struct trace_buffer *b;
+
+	b = trace_local;
+	if ( b == NULL || b->script.depth == 0 ) {
+		return;
+	}
+	trace_pop( b, &b->script );
+}
+
+/* Closes the script zones still open on this thread at the end of a
+ * frame, e.g. after an error skipped a trace.finish, so they do not pile
+ * up; they are recorded as ending here. */
+void trace_end_script_zones( )
+{
+	struct trace_buffer *b;
+
+	b = trace_local;
+	while ( b != NULL && b->script.depth > 0 ) {
+		trace_pop( b, &b->script );
+	}
+}
+
+/* Script zone names are interned, since the strings passed in may be
+ * collected before the trace is written. */
+const char *trace_intern( const char *name )
+{
+	void *v;
+	char *key;
+
+	if ( mht_get(trace_names, (void*)name, &v) == 0 ) {
+		return (const char*)v;
+	}
+	key = SDL_strdup( name );
+	mht_set( trace_names, key, key, 0 );
+	return key;
+}
+
+static void trace_write_string( FILE *f, const char *s )
+{
+	fputc( '"', f );
+	for ( ; *s; ++s ) {
+		if ( *s == '"' || *s == '\\' ) {
+			fputc( '\\', f );
+			fputc( *s, f );
+		} else if ( (unsigned char)*s < 0x20 ) {
+			fprintf( f, "\\u%04x", *s );
+		} else {
+			fputc( *s, f );
+		}
+	}
+	fputc( '"', f );
+}
+
+/* Writes every buffered event as Chrome trace JSON, which chrome://tracing
+ * and Perfetto both load. */
+static void trace_write( )
+{
+	struct trace_buffer *b;
+	struct trace_event *e;
+	double scale;
+	FILE *f;
+	int i, n, first, comma;
+
+	f = storage_open( trace_path, "w" );
+	if ( f == NULL ) {
+		log_printf( LOG_ERROR, "Failed to write trace %s", trace_path );
+		return;
+	}
+	scale = 1000000.0 / SDL_GetPerformanceFrequency( );
+	comma = 0;
+	fputs( "{\"traceEvents\":[\n", f );
+	for ( b = trace_buffers; b != NULL; b = b->next ) {
+		n = SDL_AtomicGet( &b->written );
+		first = n > TRACE_RING_SIZE ? n - TRACE_RING_SIZE : 0;
+		for ( i = first; i < n; ++i ) {
+			e = &b->events[ i & (TRACE_RING_SIZE - 1) ];
+			fputs( comma ? ",\n{\"name\":" : "{\"name\":", f );
+			trace_write_string( f, e->name );
+			fprintf( f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+				(unsigned long)b->thread,
+				(e->start - trace_origin) * scale,
+				(e->end - e->start) * scale );
+			comma = 1;
+		}
+	}
+	fputs( "\n],\"displayTimeUnit\":\"ms\"}\n", f );
+	fclose( f );
+}
+
+void trace_shutdown( )
+{
+	struct trace_buffer *b, *next;
+
+	if ( !trace_enabled ) {
+		return;
+	}
+	trace_enabled = 0;
+	trace_write( );
+	for ( b = trace_buffers; b != NULL; b = next ) {
+		next = b->next;
+		SDL_free( b );
+	}
+	trace_buffers = NULL;
+	trace_local = NULL;
+	mht_free( trace_names );
+	trace_names = NULL;
+	SDL_free( trace_path );
+	trace_path = NULL;
+}
+
+static int moonbase_trace_begin( lua_State *s )
+{
+	if ( trace_enabled ) {
+		trace_begin_script( trace_intern(luaL_checkstring(s, 1)) );
+	}
+	return 0;
+}
+
+static int moonbase_trace_finish( lua_State *s )
+{
+	if ( trace_enabled ) {
+		trace_end_script( );
+	}
+	return 0;
+}
+
+static int moonbase_trace_is_enabled( lua_State *s )
+{
+	lua_pushboolean( s, trace_enabled );
+	return 1;
+}
+
+static luaL_Reg moonbase_trace_methods[] = {
+	{ "begin", moonbase_trace_begin },
+	{ "finish", moonbase_trace_finish },
+	{ "isEnabled", moonbase_trace_is_enabled },
+	{ NULL, NULL }
+};
+
+int moonbase_trace_initialize( lua_State *s )
+{
+	luaL_newlib( s, moonbase_trace_methods );
+	return 1;
+}
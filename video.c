@@ -83,6 +83,7 @@ void video_initialize( )
 
 void video_stop_window( )
 {
+	render_reset( );
 	if ( video_renderer != NULL ) {
 		SDL_DestroyRenderer( video_renderer );
 		video_renderer = NULL;
@@ -94,9 +95,25 @@ void video_stop_window( )
 	SDL_VideoQuit( );
 }
 
+/* Lets the frame pacer know whether presenting already waits for the
+ * display, and at what rate. */
+static void video_update_vsync( )
+{
+	SDL_RendererInfo info;
+	SDL_DisplayMode mode;
+
+	if ( SDL_GetRendererInfo(video_renderer, &info) == 0 &&
+	     (info.flags & SDL_RENDERER_PRESENTVSYNC) &&
+	     SDL_GetWindowDisplayMode(video_window, &mode) == 0 ) {
+		pacer_set_vsync( mode.refresh_rate );
+	} else {
+		pacer_set_vsync( 0 );
+	}
+}
+
 void video_start_window( )
 {
-	if ( SDL_VideoInit(video_options.driver) ) {
+	if ( SDL_VideoInit(base_headless ? "dummy" : video_options.driver) ) {
 		fatal( "%s", SDL_GetError() );
 	}
 	video_window = SDL_CreateWindow(
@@ -109,11 +126,22 @@ void video_start_window( )
 	if ( video_window == NULL ) {
 		fatal( "%s", SDL_GetError() );
 	}
-	video_renderer = SDL_CreateRenderer( video_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+	if ( base_headless ) {
+		/* The dummy driver's window is an offscreen surface */
+		video_renderer = SDL_CreateRenderer( video_window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE );
+	} else {
+		video_renderer = SDL_CreateRenderer( video_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+	}
 	if ( video_renderer == NULL ) {
 		fatal( "%s", SDL_GetError() );
 	}
 	SDL_SetRenderDrawBlendMode( video_renderer, SDL_BLENDMODE_BLEND );
+	SDL_GetRenderDrawColor( video_renderer,
+		&video_options.draw_color.r,
+		&video_options.draw_color.g,
+		&video_options.draw_color.b,
+		&video_options.draw_color.a );
+	render_set_draw_color( &video_options.draw_color );
 	SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" );
 	SDL_RenderSetLogicalSize(
 		video_renderer,
@@ -126,6 +154,7 @@ void video_start_window( )
 		SDL_SetWindowDisplayMode( video_window, NULL );
 	}
 	SDL_SetWindowFullscreen( video_window, video_options.fullscreen );
+	video_update_vsync( );
 }
 
 void video_shutdown( )
@@ -234,6 +263,7 @@ void video_set_draw_color( const char *color )
 	sscanf( color, "%x", &c );
 	c = hton32 ( c );
 	video_options.draw_color = *(SDL_Color*)&c;
+	render_set_draw_color( &video_options.draw_color );
 	if ( video_renderer != NULL ) {
 		SDL_SetRenderDrawColor( video_renderer,
 			video_options.draw_color.r,
@@ -317,12 +347,30 @@ static int moonbase_video_clear( lua_State *s )
 	return 0;
 }
 
+static int moonbase_video_canvas( lua_State *s )
+{
+	void *image;
+	struct size size;
+
+	size.w = luaL_checkint( s, 1 );
+	size.h = luaL_checkint( s, 2 );
+	luaL_argcheck( s, size.w > 0 && size.h > 0, 1, "canvas size must be positive" );
+	luaL_argcheck( s, image_canvas_fits(&size), 1, "canvas larger than the maximum texture size" );
+	image = image_create_canvas( &size );
+	if ( image == NULL ) {
+		return luaL_error( s, "failed to create canvas: %s", SDL_GetError() );
+	}
+	luacom_create_object( s, &moonbase_image_class, &image, sizeof(image) );
+	return 1;
+}
+
 static int moonbase_video_draw_line( lua_State *s )
 {
 	struct point p1, p2;
+	int next;
 
-	luacom_read_array( s, 1, "ii", 1, &p1.x, 2, &p1.y );
-	luacom_read_array( s, 2, "ii", 1, &p2.x, 2, &p2.y );
+	next = geometry_check_point( s, 1, &p1 );
+	geometry_check_point( s, next, &p2 );
 	video_draw_line( &p1, &p2 );
 	return 0;
 }
@@ -330,8 +378,10 @@ static int moonbase_video_draw_line( lua_State *s )
 static int moonbase_video_draw_rect( lua_State *s )
 {
 	struct rectangle r;
+	int sized;
 
-	luacom_read_array( s, 1, "iiii", 1, &r.x, 2, &r.y, 3, &r.w, 4, &r.h );
+	geometry_check_rect( s, 1, &r, &sized );
+	luaL_argcheck( s, sized, 1, "rectangle expected" );
 	video_draw_rectangle( &r );
 	return 0;
 }
@@ -339,12 +389,82 @@ static int moonbase_video_draw_rect( lua_State *s )
 static int moonbase_video_fill_rect( lua_State *s )
 {
 	struct rectangle r;
+	int sized;
 
-	luacom_read_array( s, 1, "iiii", 1, &r.x, 2, &r.y, 3, &r.w, 4, &r.h );
+	geometry_check_rect( s, 1, &r, &sized );
+	luaL_argcheck( s, sized, 1, "rectangle expected" );
 	video_fill_rectangle( &r );
 	return 0;
 }
 
+/* The batch functions take flat arrays, { x1, y1, x2, y2, ... } for
+ * points and { x1, y1, w1, h1, ... } for rectangles, and record a single
+ * renderer call each. */
+static int video_read_points( lua_State *s, int type )
+{
+	SDL_Point *p;
+	int i, n;
+
+	luaL_checktype( s, 1, LUA_TTABLE );
+	n = (int)lua_rawlen( s, 1 );
+	luaL_argcheck( s, n % 2 == 0, 1, "incomplete point record" );
+	n /= 2;
+	if ( n == 0 ) {
+		return 0;
+	}
+	/* A bad element raises an error before anything is recorded */
+	p = render_reserve_points_batch( n );
+	for ( i = 0; i < n; ++i ) {
+		p[i].x = luacom_read_element( s, 1, i*2 + 1 );
+		p[i].y = luacom_read_element( s, 1, i*2 + 2 );
+	}
+	render_push_points( type, n );
+	return 0;
+}
+
+static int video_read_rects( lua_State *s, int type )
+{
+	SDL_Rect *r;
+	int i, n;
+
+	luaL_checktype( s, 1, LUA_TTABLE );
+	n = (int)lua_rawlen( s, 1 );
+	luaL_argcheck( s, n % 4 == 0, 1, "incomplete rectangle record" );
+	n /= 4;
+	if ( n == 0 ) {
+		return 0;
+	}
+	r = render_reserve_rects_batch( n );
+	for ( i = 0; i < n; ++i ) {
+		r[i].x = luacom_read_element( s, 1, i*4 + 1 );
+		r[i].y = luacom_read_element( s, 1, i*4 + 2 );
+		r[i].w = luacom_read_element( s, 1, i*4 + 3 );
+		r[i].h = luacom_read_element( s, 1, i*4 + 4 );
+	}
+	render_push_rects( type, n );
+	return 0;
+}
+
+static int moonbase_video_draw_lines( lua_State *s )
+{
+	return video_read_points( s, RENDER_LINES );
+}
+
+static int moonbase_video_draw_points( lua_State *s )
+{
+	return video_read_points( s, RENDER_POINTS );
+}
+
+static int moonbase_video_draw_rects( lua_State *s )
+{
+	return video_read_rects( s, RENDER_RECTS );
+}
+
+static int moonbase_video_fill_rects( lua_State *s )
+{
+	return video_read_rects( s, RENDER_FILL_RECTS );
+}
+
 static int moonbase_video_message_box( lua_State *s )
 {
 	const char *message;
@@ -398,18 +518,23 @@ static int moonbase_video_get_driver( lua_State *s )
 	return 1;
 }
 
+static int moonbase_video_get_layer( lua_State *s )
+{
+	lua_pushinteger( s, render_get_layer() );
+	return 1;
+}
+
 static int moonbase_video_get_mode( lua_State *s )
 {
 	const struct video_mode *mode;
 
 	mode = video_get_mode( );
 	lua_createtable( s, 0, 4 );
-	luacom_write_table( s, 1, "uip",
+	luacom_write_table( s, -1, "uip",
 		"format", mode->format,
 		"refresh_rate", mode->refresh_rate,
 		"opaque", mode->opaque );
-	lua_createtable( s, 0, 2 );
-	luacom_write_array( s, -1, "ii", mode->size.w, mode->size.h );
+	luacom_push_size( s, mode->size.w, mode->size.h );
 	lua_setfield( s, -2, "size" );
 	return 1;
 }
@@ -419,8 +544,7 @@ static int moonbase_video_get_position( lua_State *s )
 	const struct point *point;
 
 	point = video_get_position(  );
-	lua_createtable( s, 0, 2 );
-	luacom_write_array( s, -1, "ii", 1, point->x, 2, point->y );
+	luacom_fill_point( s, 1, point->x, point->y );
 	return 1;
 }
 
@@ -429,11 +553,20 @@ static int moonbase_video_get_size( lua_State *s )
 	const struct size *size;
 
 	size = video_get_size(  );
-	lua_createtable( s, 0, 2 );
-	luacom_write_array( s, -1, "ii", 1, size->w, 2, size->h );
+	luacom_fill_size( s, 1, size->w, size->h );
 	return 1;
 }
 
+static int moonbase_video_get_dimensions( lua_State *s )
+{
+	const struct size *size;
+
+	size = video_get_size( );
+	lua_pushinteger( s, size->w );
+	lua_pushinteger( s, size->h );
+	return 2;
+}
+
 static int moonbase_video_get_title( lua_State *s )
 {
 	const char *title;
@@ -467,6 +600,14 @@ static int moonbase_video_set_fullscreen( lua_State *s )
 	return 0;
 }
 
+static int moonbase_video_set_layer( lua_State *s )
+{
+	static const char *orders[] = { "painter", "texture", NULL };
+
+	render_set_layer( luaL_checkint(s, 1), luaL_checkoption(s, 2, "painter", orders) );
+	return 0;
+}
+
 static int moonbase_video_set_input_grabbed( lua_State *s )
 {
 	video_set_input_grabbed( luaL_checkint(s, 1) );
@@ -482,7 +623,7 @@ static int moonbase_video_set_mode( lua_State *s )
 		"refreshRate", &mode.refresh_rate,
 		"opaque", &mode.opaque );
 	lua_getfield( s, 1, "size" );
-	luacom_read_array( s, -1, "ii", 1, &mode.size.w, 2, &mode.size.h );
+	luacom_read_point( s, -1, &mode.size.w, &mode.size.h );
 	video_set_mode( &mode );
 	return 0;
 }
@@ -491,7 +632,7 @@ static int moonbase_video_set_position( lua_State *s )
 {
 	struct point position;
 
-	luacom_read_array( s, 1, "ii", 1, &position.x, 2, &position.y );
+	geometry_check_point( s, 1, &position );
 	video_set_position( &position );
 	return 0;
 }
@@ -499,8 +640,11 @@ static int moonbase_video_set_position( lua_State *s )
 static int moonbase_video_set_size( lua_State *s )
 {
 	struct size size;
+	struct point p;
 
-	luacom_read_array( s, 1, "ii", 1, &size.w, 2, &size.h );
+	geometry_check_point( s, 1, &p );
+	size.w = p.x;
+	size.h = p.y;
 	video_set_size( &size );
 	return 0;
 }
@@ -511,14 +655,26 @@ static int moonbase_video_set_title( lua_State *s )
 	return 0;
 }
 
+extern int moonbase_video_command_buffer( lua_State *s );
+extern int moonbase_video_tilemap( lua_State *s );
+extern int moonbase_video_layer( lua_State *s );
+
 static luaL_Reg moonbase_video_methods[] = {
 	/* Operations */
+	{ "canvas", moonbase_video_canvas },
 	{ "clear", moonbase_video_clear },
+	{ "commandBuffer", moonbase_video_command_buffer },
 	{ "drawLine", moonbase_video_draw_line },
+	{ "drawLines", moonbase_video_draw_lines },
+	{ "drawPoints", moonbase_video_draw_points },
 	{ "drawRect", moonbase_video_draw_rect }, 
+	{ "drawRects", moonbase_video_draw_rects },
 	{ "fillRect", moonbase_video_fill_rect },
+	{ "fillRects", moonbase_video_fill_rects },
+	{ "layer", moonbase_video_layer },
 	{ "messageBox", moonbase_video_message_box },
 	{ "restart", moonbase_video_restart },
+	{ "tilemap", moonbase_video_tilemap },
 
 	/* Accessors */
 	{ "isFullscreen", moonbase_video_is_fullscreen },
@@ -526,9 +682,11 @@ static luaL_Reg moonbase_video_methods[] = {
 	{ "getBrightness", moonbase_video_get_brightness },
 	{ "getDisplay", moonbase_video_get_display },
 	{ "getDriver", moonbase_video_get_driver },
+	{ "getLayer", moonbase_video_get_layer },
 	{ "getMode", moonbase_video_get_mode },
 	{ "getPosition", moonbase_video_get_position },
 	{ "getSize", moonbase_video_get_size },
+	{ "getDimensions", moonbase_video_get_dimensions },
 	{ "getTitle", moonbase_video_get_title },
 
 	/* Mutators */
@@ -536,6 +694,7 @@ static luaL_Reg moonbase_video_methods[] = {
 	{ "setDrawColor", moonbase_video_set_draw_color },
 	{ "setDriver", moonbase_video_set_driver },
 	{ "setFullscreen", moonbase_video_set_fullscreen },
+	{ "setLayer", moonbase_video_set_layer },
 	{ "setInputGrabbed", moonbase_video_set_input_grabbed },
 	{ "setMode", moonbase_video_set_mode },
 	{ "setPosition", moonbase_video_set_position },
@@ -566,15 +725,9 @@ static void moonbase_video_push_displays_table( lua_State *s )
 	for ( i = 0; i < video_num_displays; ++i ) {
 		disp = video_displays + i;
 		lua_createtable( s, 0, 4 );
-		lua_createtable( s, 0, 2 );
-		luacom_write_array( s, -1, "ii",
-			1, disp->location.x,
-			2, disp->location.y );
+		luacom_push_point( s, disp->location.x, disp->location.y );
 		lua_setfield( s, -2, "location" );
-		lua_createtable( s, 0, 2 );
-		luacom_write_array( s, -1, "ii",
-			1, disp->size.w,
-			2, disp->size.h );
+		luacom_push_size( s, disp->size.w, disp->size.h );
 		lua_setfield( s, -2, "size" );
 		/*lua_createtable( s, 0, 3 );
 		luacom_write_array( s, -1, "nnn",
@@ -590,8 +743,7 @@ static void moonbase_video_push_displays_table( lua_State *s )
 				"format", mode->format,
 				"refreshRate", mode->refresh_rate,
 				"opaque", mode->opaque );
-			lua_createtable( s, 0, 2 );
-			luacom_write_array( s, -1, "ii", 1, mode->size.w, 2, mode->size.h );
+			luacom_push_size( s, mode->size.w, mode->size.h );
 			lua_setfield( s, -2, "size" );
 			lua_rawseti( s, -2, j+1 );
 		}